@@ -0,0 +1,549 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "colorchecker.h"
+#include "lut.h"
+#include "parallel.h"
+#include "piraw.h"
+#include "util.h"
+
+// Synthetic benchmarks for the calibration hot paths. Inputs are generated,
+// so no camera or test.jpg is needed.
+//
+// Usage: benchmark [output.json]
+//        benchmark --check
+// --check verifies the batch kernels against their scalar counterparts, and
+// the thread pool's scheduling, instead, exiting non-zero on any failure.
+
+namespace {
+
+constexpr int32_t kImageX = 1640;
+constexpr int32_t kImageY = 1232;
+// FindPossibleMinimum runs ScoreLut ~50 times per call; keep it tractable.
+constexpr int32_t kSmallImageX = kImageX / 4;
+constexpr int32_t kSmallImageY = kImageY / 4;
+
+
+struct BenchmarkResult {
+  std::string name;
+  int64_t pixels;
+  int64_t bytes;
+  int32_t warmup;
+  int32_t reps;
+  double mean_ns;
+  double stddev_ns;
+  double min_ns;
+  double max_ns;
+};
+
+// Keeps results alive so the optimizer can't discard the measured work.
+volatile int64_t sink;
+
+// Small deterministic LCG; std::rand() isn't guaranteed to be reproducible
+// across standard libraries.
+class Lcg {
+ public:
+  explicit Lcg(uint32_t seed);
+
+  uint32_t Next();
+
+ private:
+  uint32_t state_;
+};
+
+Lcg::Lcg(uint32_t seed)
+    : state_(seed) {}
+
+uint32_t Lcg::Next() {
+  state_ = state_ * 1664525 + 1013904223;
+  return state_;
+}
+
+std::string GenerateRaw(int32_t bytes) {
+  Lcg lcg(1);
+  std::string raw;
+  raw.resize(static_cast<size_t>(bytes));
+  for (auto& byte : raw) {
+    byte = static_cast<char>(lcg.Next() >> 24);
+  }
+  return raw;
+}
+
+// 6x4 grid of ColorChecker patches on a mid-gray background, with noise.
+template <int32_t X, int32_t Y>
+std::unique_ptr<Image<X, Y, RgbColor>> GenerateColorChecker() {
+  constexpr int32_t kNoise = 0x0800;
+  const Color<3> background = {{{{0x8000, 0x8000, 0x8000}}}};
+
+  Lcg lcg(2);
+  auto image = std::make_unique<Image<X, Y, RgbColor>>();
+
+  for (int32_t y = 0; y < Y; ++y) {
+    auto& row = image->at(y);
+    for (int32_t x = 0; x < X; ++x) {
+      const auto patch_x = (x * 8) / X - 1;
+      const auto patch_y = (y * 6) / Y - 1;
+      const auto in_patch = patch_x >= 0 && patch_x < 6 && patch_y >= 0 && patch_y < 4;
+      const auto& base = in_patch ? kColorCheckerSrgb.at(patch_y * 6 + patch_x) : background;
+
+      RgbColor pixel;
+      for (int32_t c = 0; c < 3; ++c) {
+        const auto noise = static_cast<int32_t>(lcg.Next() >> 16) % kNoise - kNoise / 2;
+        pixel.at(c) = base.at(c) + noise;
+      }
+      row.at(x) = pixel.Crop();
+    }
+  }
+
+  return image;
+}
+
+template <class F>
+BenchmarkResult RunBenchmark(const std::string& name, int64_t pixels, int64_t bytes, int32_t warmup, int32_t reps, F&& callback) {
+  for (int32_t i = 0; i < warmup; ++i) {
+    callback();
+  }
+
+  std::vector<double> samples;
+  for (int32_t i = 0; i < reps; ++i) {
+    auto start = std::chrono::steady_clock::now();
+    callback();
+    auto end = std::chrono::steady_clock::now();
+    samples.push_back(static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()));
+  }
+
+  BenchmarkResult result;
+  result.name = name;
+  result.pixels = pixels;
+  result.bytes = bytes;
+  result.warmup = warmup;
+  result.reps = reps;
+
+  double sum = 0;
+  for (const auto& sample : samples) {
+    sum += sample;
+  }
+  result.mean_ns = sum / reps;
+
+  double variance = 0;
+  for (const auto& sample : samples) {
+    variance += (sample - result.mean_ns) * (sample - result.mean_ns);
+  }
+  result.stddev_ns = std::sqrt(variance / reps);
+
+  result.min_ns = *std::min_element(samples.begin(), samples.end());
+  result.max_ns = *std::max_element(samples.begin(), samples.end());
+
+  std::cerr << std::left << std::setw(32) << name
+            << std::right << std::fixed << std::setprecision(3)
+            << std::setw(12) << result.mean_ns / 1e6 << " ms"
+            << " +/- " << std::setw(8) << result.stddev_ns / 1e6 << " ms"
+            << std::setw(10) << result.mean_ns / static_cast<double>(pixels) << " ns/px"
+            << std::setw(10) << static_cast<double>(bytes) * 1e3 / result.mean_ns << " MB/s"
+            << std::endl;
+
+  return result;
+}
+
+std::string ToJson(const std::vector<BenchmarkResult>& results) {
+  std::ostringstream os;
+  os << std::fixed << std::setprecision(3);
+  os << "{\"benchmarks\": [\n";
+  for (size_t i = 0; i < results.size(); ++i) {
+    const auto& result = results.at(i);
+    os << "  {"
+       << "\"name\": \"" << result.name << "\", "
+       << "\"pixels\": " << result.pixels << ", "
+       << "\"bytes\": " << result.bytes << ", "
+       << "\"warmup\": " << result.warmup << ", "
+       << "\"reps\": " << result.reps << ", "
+       << "\"mean_ns\": " << result.mean_ns << ", "
+       << "\"stddev_ns\": " << result.stddev_ns << ", "
+       << "\"min_ns\": " << result.min_ns << ", "
+       << "\"max_ns\": " << result.max_ns << ", "
+       << "\"ns_per_pixel\": " << result.mean_ns / static_cast<double>(result.pixels) << ", "
+       << "\"mb_per_s\": " << static_cast<double>(result.bytes) * 1e3 / result.mean_ns
+       << "}" << (i < results.size() - 1 ? "," : "") << "\n";
+  }
+  os << "]}\n";
+  return os.str();
+}
+
+// Channel values for exhaustive grid checks: a regular grid plus the edges
+// and the 1/6 hue sector boundaries.
+std::vector<int32_t> GetCheckValues(int32_t step) {
+  std::vector<int32_t> values;
+  for (int32_t v = kMinColor; v <= kMaxColor; v += step) {
+    values.push_back(v);
+  }
+  for (int32_t v : {1, 2, 3, 10922, 10923, 21844, 32768, kMaxColor - 2, kMaxColor - 1, kMaxColor}) {
+    values.push_back(v);
+  }
+  return values;
+}
+
+// RgbToHsvRow and HsvToRgbRow must be bit-exact with the scalar
+// RgbColor <-> HsvColor operators. Returns the number of mismatches.
+int64_t CheckHsvRows() {
+  int64_t mismatches = 0;
+
+  const auto values = GetCheckValues(255);
+  const auto width = static_cast<int32_t>(values.size());
+  std::vector<Color<3>> in(values.size()), out(values.size());
+
+  int64_t checked = 0;
+  for (const auto r : values) {
+    for (const auto g : values) {
+      for (size_t i = 0; i < values.size(); ++i) {
+        in.at(i) = {{{{r, g, values.at(i)}}}};
+      }
+      RgbToHsvRow(in.data(), width, out.data());
+      for (size_t i = 0; i < values.size(); ++i) {
+        const Color<3> expected = RgbColor(in.at(i)).operator HsvColor();
+        if (!(expected == out.at(i))) {
+          if (!mismatches++) {
+            std::cerr << "RgbToHsvRow mismatch at " << in.at(i) << std::endl;
+          }
+        }
+      }
+      checked += width;
+    }
+  }
+
+  // Every divisor in the reciprocal table: max channel m (saturation) and
+  // max - min (hue), with numerators spread over [0, m].
+  constexpr int32_t kNumerators = 64;
+  in.resize(kNumerators * 2);
+  out.resize(kNumerators * 2);
+  for (int32_t m = 1; m <= kMaxColor; ++m) {
+    for (int32_t i = 0; i < kNumerators; ++i) {
+      const auto mid = static_cast<int32_t>(static_cast<int64_t>(m) * i / (kNumerators - 1));
+      in.at(static_cast<size_t>(i)) = {{{{m, mid, 0}}}};
+      in.at(static_cast<size_t>(kNumerators + i)) = {{{{m / 3, mid, m}}}};
+    }
+    RgbToHsvRow(in.data(), kNumerators * 2, out.data());
+    for (size_t i = 0; i < in.size(); ++i) {
+      const Color<3> expected = RgbColor(in.at(i)).operator HsvColor();
+      if (!(expected == out.at(i))) {
+        if (!mismatches++) {
+          std::cerr << "RgbToHsvRow mismatch at " << in.at(i) << std::endl;
+        }
+      }
+    }
+    checked += kNumerators * 2;
+  }
+  std::cout << "RgbToHsvRow: " << checked << " colors checked" << std::endl;
+
+  // Hue past either end and out-of-range saturation and value, as LUT
+  // mapping can produce.
+  std::vector<int32_t> hues;
+  for (int32_t h = -kMaxColor - kMaxColor / 10; h < kMaxColor * 2; h += 7) {
+    hues.push_back(h);
+  }
+  auto sv = GetCheckValues(1023);
+  for (int32_t v : {-5, kMaxColor + 1, kMaxColor + 5000}) {
+    sv.push_back(v);
+  }
+  const auto hue_width = static_cast<int32_t>(hues.size());
+  in.resize(hues.size());
+  out.resize(hues.size());
+
+  checked = 0;
+  for (const auto sat : sv) {
+    for (const auto val : sv) {
+      for (size_t i = 0; i < hues.size(); ++i) {
+        in.at(i) = {{{{hues.at(i), sat, val}}}};
+      }
+      HsvToRgbRow(in.data(), hue_width, out.data());
+      for (size_t i = 0; i < hues.size(); ++i) {
+        const Color<3> expected = HsvColor(in.at(i)).operator RgbColor();
+        if (!(expected == out.at(i))) {
+          if (!mismatches++) {
+            std::cerr << "HsvToRgbRow mismatch at " << in.at(i) << std::endl;
+          }
+        }
+      }
+      checked += hue_width;
+    }
+  }
+  std::cout << "HsvToRgbRow: " << checked << " colors checked" << std::endl;
+
+  return mismatches;
+}
+
+thread_local char thread_token;
+
+// Runs count tasks on pool, each nesting depth more levels of ParallelFor().
+// Checks that every task runs exactly once and that no two threads run tasks
+// of one call under the same thread index. Adds the tasks run to *tasks;
+// returns the number of failures.
+int64_t CheckParallelFor(ThreadPool* pool, int32_t count, int32_t depth, std::atomic<int64_t>* tasks) {
+  std::vector<std::atomic<int32_t>> runs(static_cast<size_t>(count));
+  for (auto& run : runs) {
+    run.store(0);
+  }
+  // Which thread is running a task under each index. A thread waiting on a
+  // nested call may run more of the outer call's tasks, so it can hold an
+  // index more than once.
+  std::vector<std::atomic<const char*>> owners(static_cast<size_t>(pool->GetNumThreads()));
+  for (auto& owner : owners) {
+    owner.store(nullptr);
+  }
+  std::atomic<int64_t> failures(0);
+
+  pool->ParallelFor(count, [&](int32_t i) {
+    const auto index = ThreadPool::GetThreadIndex();
+    if (index < 0 || index >= pool->GetNumThreads()) {
+      ++failures;
+      return;
+    }
+    auto& owner = owners.at(static_cast<size_t>(index));
+    const auto previous = owner.exchange(&thread_token);
+    if (previous && previous != &thread_token) {
+      ++failures;
+    }
+
+    ++runs.at(static_cast<size_t>(i));
+    ++*tasks;
+    if (i % 7 == 0) {
+      // Uneven tasks, so threads run out of their own and steal.
+      std::this_thread::yield();
+    }
+    if (depth) {
+      failures += CheckParallelFor(pool, i % 6, depth - 1, tasks);
+    }
+
+    owner.store(previous);
+  });
+
+  for (const auto& run : runs) {
+    if (run.load() != 1) {
+      ++failures;
+    }
+  }
+  return failures.load();
+}
+
+// ParallelFor() over uneven counts, nested, and from several threads at
+// once, on pools of several sizes. Returns the number of failures.
+int64_t CheckThreadPool() {
+  int64_t failures = 0;
+  std::atomic<int64_t> tasks(0);
+
+  for (int32_t num_threads : {1, 2, 3, 4, 8}) {
+    ThreadPool pool(num_threads);
+    for (int32_t count = 0; count <= 64; ++count) {
+      failures += CheckParallelFor(&pool, count, count % 3, &tasks);
+    }
+
+    constexpr int32_t kCallers = 4;
+    std::atomic<int64_t> caller_failures(0);
+    std::vector<std::thread> callers;
+    for (int32_t i = 0; i < kCallers; ++i) {
+      callers.emplace_back([&pool, &caller_failures, &tasks]() {
+        for (int32_t count = 0; count <= 32; ++count) {
+          caller_failures += CheckParallelFor(&pool, count, 1, &tasks);
+        }
+      });
+    }
+    for (auto& caller : callers) {
+      caller.join();
+    }
+    failures += caller_failures.load();
+  }
+  std::cout << "ThreadPool: " << tasks.load() << " tasks checked" << std::endl;
+
+  return failures;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  if (argc > 1 && std::string(argv[1]) == "--check") {
+    const auto failures = CheckHsvRows() + CheckThreadPool();
+    std::cout << failures << " failures" << std::endl;
+    return failures ? 1 : 0;
+  }
+
+  const std::string output = argc > 1 ? argv[1] : "bench.json";
+
+  const auto raw = GenerateRaw(PiRaw2::GetRawBytes());
+  const auto image = GenerateColorChecker<kImageX, kImageY>();
+  const auto small_image = GenerateColorChecker<kSmallImageX, kSmallImageY>();
+
+  constexpr int64_t kPixels = int64_t(kImageX) * kImageY;
+  constexpr int64_t kImageBytes = kPixels * int64_t(sizeof(RgbColor));
+  constexpr int64_t kSmallPixels = int64_t(kSmallImageX) * kSmallImageY;
+  constexpr int64_t kSmallImageBytes = kSmallPixels * int64_t(sizeof(RgbColor));
+
+  const auto lut1d = MinimalLut1d::Identity();
+  const auto lut3d = ColorCheckerLut3d::Identity();
+  const auto hsv_lut1d = MinimalHsvLut1d::Identity();
+
+  std::vector<BenchmarkResult> results;
+
+  results.push_back(RunBenchmark("PiRaw2::FromRaw", kPixels, PiRaw2::GetRawBytes(), 1, 10, [&]() {
+    sink = PiRaw2::FromRaw(raw)->at(0).at(0).at(0);
+  }));
+
+  for (const auto& mode : kPiRawModes) {
+    const auto mode_raw = GenerateRaw(mode.GetRawBytes());
+    const int64_t pixels = int64_t(mode.x / 2) * (mode.y / 2);
+    results.push_back(RunBenchmark(std::string("DynamicPiRaw::FromRaw/") + mode.name, pixels, mode.GetRawBytes(), 1, 10, [&]() {
+      sink = DynamicPiRaw::FromRaw(mode, mode_raw)->GetRow(0)[0].at(0);
+    }));
+  }
+
+  results.push_back(RunBenchmark("FirstPass/separate", kPixels, PiRaw2::GetRawBytes(), 1, 5, [&]() {
+    auto decoded = PiRaw2::FromRaw(raw);
+    ExposureStats exposure;
+    for (int32_t y = 0; y < decoded->GetHeight(); ++y) {
+      exposure.AddRow(y, decoded->GetRow(y), decoded->GetWidth());
+    }
+    sink = FindClosest(*decoded).at(0).at(0) + ScoreLut(*decoded, lut1d) + exposure.GetMean(0);
+  }));
+
+  results.push_back(RunBenchmark("FirstPass/fused", kPixels, PiRaw2::GetRawBytes(), 1, 5, [&]() {
+    ColorCheckerAnalysis<> analysis(lut1d);
+    PiRaw2::FromRaw(raw, [&analysis](int32_t y, const RgbColor* row, int32_t width) {
+      analysis.AddRow(y, row, width);
+    });
+    sink = analysis.closest.GetClosest().at(0).at(0) + analysis.score.GetScore() + analysis.exposure.GetMean(0);
+  }));
+
+  for (auto demosaic : {Demosaic::kBilinear, Demosaic::kMalvar}) {
+    const auto& mode = kPiRawModes.at(1);
+    const int64_t pixels = int64_t(mode.x) * mode.y;
+    const auto name = demosaic == Demosaic::kBilinear ? "DemosaicRaw/bilinear" : "DemosaicRaw/malvar";
+    results.push_back(RunBenchmark(name, pixels, mode.GetRawBytes(), 1, 5, [&]() {
+      sink = DynamicPiRaw::FromRaw(mode, raw, demosaic)->GetRow(0)[0].at(0);
+    }));
+  }
+
+  results.push_back(RunBenchmark("Lut1d::MapColor", kPixels, kImageBytes, 1, 10, [&]() {
+    int64_t sum = 0;
+    image->ForEach([&](const RgbColor& color) {
+      sum += lut1d.MapColor(color).at(0);
+    });
+    sink = sum;
+  }));
+
+  results.push_back(RunBenchmark("Lut3d::MapColor", kPixels, kImageBytes, 1, 10, [&]() {
+    int64_t sum = 0;
+    image->ForEach([&](const RgbColor& color) {
+      sum += lut3d.MapColor(color).at(0);
+    });
+    sink = sum;
+  }));
+
+  results.push_back(RunBenchmark("Lut1d::MapImage", kPixels, kImageBytes, 1, 10, [&]() {
+    sink = lut1d.MapImage(*image)->at(0).at(0).at(0);
+  }));
+
+  results.push_back(RunBenchmark("Lut3d::MapImage", kPixels, kImageBytes, 1, 10, [&]() {
+    sink = lut3d.MapImage(*image)->at(0).at(0).at(0);
+  }));
+
+  results.push_back(RunBenchmark("RgbColor::operator HsvColor", kPixels, kImageBytes, 1, 10, [&]() {
+    int64_t sum = 0;
+    image->ForEach([&](const RgbColor& color) {
+      sum += color.operator HsvColor().at(0);
+    });
+    sink = sum;
+  }));
+
+  results.push_back(RunBenchmark("RgbToHsvRow", kPixels, kImageBytes, 1, 10, [&]() {
+    std::vector<Color<3>> hsv(kImageX);
+    int64_t sum = 0;
+    for (int32_t y = 0; y < kImageY; ++y) {
+      RgbToHsvRow(image->GetRow(y), kImageX, hsv.data());
+      sum += hsv.at(0).at(0);
+    }
+    sink = sum;
+  }));
+
+  results.push_back(RunBenchmark("HsvToRgbRow", kPixels, kImageBytes, 1, 10, [&]() {
+    std::vector<Color<3>> rgb(kImageX);
+    int64_t sum = 0;
+    for (int32_t y = 0; y < kImageY; ++y) {
+      // Any values do; the image is read as HSV.
+      HsvToRgbRow(image->GetRow(y), kImageX, rgb.data());
+      sum += rgb.at(0).at(0);
+    }
+    sink = sum;
+  }));
+
+  results.push_back(RunBenchmark("HsvLut1d::MapImage", kPixels, kImageBytes, 1, 10, [&]() {
+    sink = hsv_lut1d.MapImage(*image)->at(0).at(0).at(0);
+  }));
+
+  results.push_back(RunBenchmark("ScoreLut/Lut1d", kPixels, kImageBytes, 1, 10, [&]() {
+    sink = ScoreLut(*image, lut1d);
+  }));
+
+  results.push_back(RunBenchmark("ScoreLut/Lut3d", kPixels, kImageBytes, 1, 10, [&]() {
+    sink = ScoreLut(*image, lut3d);
+  }));
+
+  // Perceptual metrics, against the ScoreLut/Lut1d (L1) baseline above.
+  results.push_back(RunBenchmark("ScoreLut/Lut1d/de76", kPixels, kImageBytes, 1, 10, [&]() {
+    sink = ScoreLut<Cie76Distance>(*image, lut1d);
+  }));
+
+  results.push_back(RunBenchmark("ScoreLut/Lut1d/de2000", kPixels, kImageBytes, 0, 1, [&]() {
+    sink = ScoreLut<Cie2000Distance>(*image, lut1d);
+  }));
+
+  {
+    // Distinct frames, so nothing is shared between them.
+    ImageSet<Image<kImageX, kImageY, RgbColor>> image_set;
+    for (int32_t i = 0; i < 4; ++i) {
+      image_set.push_back({GenerateColorChecker<kImageX, kImageY>(), 1});
+    }
+    results.push_back(RunBenchmark("ScoreLut/Lut1d/set4", kPixels * 4, kImageBytes * 4, 1, 5, [&]() {
+      sink = ScoreLut(image_set, lut1d);
+    }));
+  }
+
+  results.push_back(RunBenchmark("FindClosest", kPixels, kImageBytes, 1, 10, [&]() {
+    sink = FindClosest(*image).at(0).at(0);
+  }));
+
+  results.push_back(RunBenchmark("FindPossibleMinimum/Lut1d", kSmallPixels, kSmallImageBytes, 0, 3, [&]() {
+    sink = FindPossibleMinimum<int32_t, int32_t, 8>(
+      -UINT16_MAX, UINT16_MAX * 2,
+      [&](int32_t val) {
+        auto test_lut = lut1d;
+        test_lut.at(1).at(0) = val;
+        return ScoreLut(*small_image, test_lut);
+      });
+  }));
+
+  // One channel search at full size, exact and sampled.
+  for (const auto& sampling : {kExactScoring, kSampledScoring}) {
+    const auto samples = MakePixelSamples(*image, sampling);
+    const auto name = sampling.enabled ? "FindPossibleMinimum/Lut1d/sampled" : "FindPossibleMinimum/Lut1d/exact";
+    results.push_back(RunBenchmark(name, kPixels, kImageBytes, 0, 1, [&]() {
+      sink = FindPossibleMinimumCoarseToFine<int32_t, int64_t, 8>(
+        kLutSearchMin, kLutSearchMax,
+        [&](int32_t val, int32_t width) {
+          auto test_lut = lut1d;
+          test_lut.at(1).at(0) = val;
+          return ScoreLutForRange(*image, samples, sampling, test_lut, width);
+        });
+    }));
+  }
+
+  results.push_back(RunBenchmark("Image::ToPng", kPixels, kImageBytes, 0, 3, [&]() {
+    sink = static_cast<int64_t>(image->ToPng().size());
+  }));
+
+  WriteFile(output, ToJson(results));
+}
@@ -1,10 +1,51 @@
 #include "color.h"
 
+namespace {
+
+constexpr int32_t kSection = kNumColors / 6;
+
+// floor(2^32 / d), saturated to UINT32_MAX for d = 1; 0 for d = 0.
+class Reciprocals {
+ public:
+  Reciprocals();
+
+  uint32_t Get(int32_t d) const;
+
+ private:
+  Array<uint32_t, kNumColors> reciprocals_;
+};
+
+Reciprocals::Reciprocals() {
+  reciprocals_.at(0) = 0;
+  reciprocals_.at(1) = UINT32_MAX;
+  for (int32_t d = 2; d < kNumColors; ++d) {
+    reciprocals_.at(d) = static_cast<uint32_t>((UINT64_C(1) << 32) / static_cast<uint64_t>(d));
+  }
+}
+
+uint32_t Reciprocals::Get(int32_t d) const {
+  return reciprocals_[static_cast<size_t>(d)];
+}
+
+const Reciprocals& GetReciprocals() {
+  static const Reciprocals reciprocals;
+  return reciprocals;
+}
+
+// n / d, truncating, for d in [1, kMaxColor]. The reciprocal is rounded down
+// by less than one, which for n < 2^32 puts the estimate at most one below
+// the quotient; one conditional increment corrects it.
+inline uint32_t Divide(uint32_t n, uint32_t d, uint32_t reciprocal) {
+  const auto q = static_cast<uint32_t>((static_cast<uint64_t>(n) * reciprocal) >> 32);
+  return q + (n - q * d >= d ? 1 : 0);
+}
+
+}  // namespace
+
 RgbColor::RgbColor(const Color<3>& src)
     : Color<3>(src) {}
 
 RgbColor::operator HsvColor() const {
-  constexpr int32_t kSection = kNumColors / 6;
   int32_t max = *std::max_element(this->begin(), this->end());
   int32_t min = *std::min_element(this->begin(), this->end());
   int32_t delta = max - min;
@@ -38,3 +79,98 @@ RgbColor::operator HsvColor() const {
 
 HsvColor::HsvColor(const Color<3>& src)
     : Color<3>(src) {}
+
+HsvColor::operator RgbColor() const {
+  // Inverse of RgbColor::operator HsvColor(): hue is an offset of up to one
+  // section either side of the max channel's section (0, 2 or 4), and is
+  // proportional to the difference of the other two channels.
+  int32_t hue = this->at(0) & kMaxColor;
+  const int32_t sat = std::max(kMinColor, std::min(kMaxColor, this->at(1)));
+  const int32_t max = std::max(kMinColor, std::min(kMaxColor, this->at(2)));
+  const int32_t delta = static_cast<int32_t>((static_cast<int64_t>(sat) * max + kMaxColor / 2) / kMaxColor);
+  const int32_t min = max - delta;
+
+  if (hue > 5 * kSection) {
+    hue -= kNumColors;
+  }
+
+  int32_t max_channel;
+  if (hue <= kSection) {
+    max_channel = 0;
+  } else if (hue <= 3 * kSection) {
+    max_channel = 1;
+    hue -= 2 * kSection;
+  } else {
+    max_channel = 2;
+    hue -= 4 * kSection;
+  }
+  hue = std::max(-kSection, std::min(kSection, hue));
+
+  const int32_t mid = min + (std::abs(hue) * delta + kSection / 2) / kSection;
+
+  RgbColor ret;
+  ret.at(max_channel) = max;
+  ret.at((max_channel + 1) % 3) = hue >= 0 ? mid : min;
+  ret.at((max_channel + 2) % 3) = hue >= 0 ? min : mid;
+  return ret;
+}
+
+
+// The row kernels below mirror the operators above step for step, with
+// branches turned into selects.
+
+void RgbToHsvRow(const Color<3>* in, int32_t width, Color<3>* out) {
+  const auto& reciprocals = GetReciprocals();
+
+  for (int32_t x = 0; x < width; ++x) {
+    const int32_t r = in[x][0];
+    const int32_t g = in[x][1];
+    const int32_t b = in[x][2];
+
+    const int32_t max = std::max(r, std::max(g, b));
+    const int32_t min = std::min(r, std::min(g, b));
+    const int32_t delta = max - min;
+
+    const bool red = max == r;
+    const bool green = !red && max == g;
+    const int32_t num = kSection * (red ? g - b : green ? b - r : r - g);
+    const int32_t base = red ? 0 : green ? 2 * kSection : 4 * kSection;
+
+    const auto hue_q = static_cast<int32_t>(Divide(static_cast<uint32_t>(std::abs(num)), static_cast<uint32_t>(delta), reciprocals.Get(delta)));
+    int32_t hue = (num < 0 ? -hue_q : hue_q) + base;
+    hue += hue < 0 ? kNumColors : 0;
+
+    const auto sat = static_cast<int32_t>(Divide(static_cast<uint32_t>(delta) * kMaxColor, static_cast<uint32_t>(max), reciprocals.Get(max)));
+
+    auto& hsv = out[x];
+    hsv[0] = delta == 0 ? 0 : hue;
+    hsv[1] = delta == 0 ? 0 : sat;
+    hsv[2] = max;
+  }
+}
+
+void HsvToRgbRow(const Color<3>* in, int32_t width, Color<3>* out) {
+  for (int32_t x = 0; x < width; ++x) {
+    int32_t hue = in[x][0] & kMaxColor;
+    const int32_t sat = std::max(kMinColor, std::min(kMaxColor, in[x][1]));
+    const int32_t max = std::max(kMinColor, std::min(kMaxColor, in[x][2]));
+    const auto delta = static_cast<int32_t>((static_cast<uint32_t>(sat) * static_cast<uint32_t>(max) + kMaxColor / 2) / kMaxColor);
+    const int32_t min = max - delta;
+
+    hue -= hue > 5 * kSection ? kNumColors : 0;
+
+    const bool red = hue <= kSection;
+    const bool green = !red && hue <= 3 * kSection;
+    hue -= red ? 0 : green ? 2 * kSection : 4 * kSection;
+    hue = std::max(-kSection, std::min(kSection, hue));
+
+    const int32_t mid = min + (std::abs(hue) * delta + kSection / 2) / kSection;
+    const int32_t up = hue >= 0 ? mid : min;
+    const int32_t down = hue >= 0 ? min : mid;
+
+    auto& rgb = out[x];
+    rgb[0] = red ? max : green ? down : up;
+    rgb[1] = red ? up : green ? max : down;
+    rgb[2] = red ? down : green ? up : max;
+  }
+}
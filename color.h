@@ -36,9 +36,20 @@ struct RgbColor : public Color<3> {
 struct HsvColor : public Color<3> {
   HsvColor() = default;
   HsvColor(const Color<3>& src);
+
+  // Hue wraps; saturation and value are cropped first.
+  operator RgbColor() const;
 };
 
 
+// Row-at-a-time equivalents of the conversion operators above, bit-exact
+// with them. Branch-free with table reciprocals in place of division, so the
+// compiler can vectorize them. RgbToHsvRow requires channels in
+// [kMinColor, kMaxColor].
+void RgbToHsvRow(const Color<3>* rgb, int32_t width, Color<3>* hsv);
+void HsvToRgbRow(const Color<3>* hsv, int32_t width, Color<3>* rgb);
+
+
 template <int32_t C>
 constexpr int32_t Color<C>::AbsDiff(const Color<C>& other) const {
   int32_t diff = 0;
@@ -0,0 +1,87 @@
+#include "colorchecker.h"
+
+template <class D>
+ClosestFinder<D>::ClosestFinder() {
+  diff_.fill(std::numeric_limits<typename D::Value>::max());
+}
+
+template <class D>
+void ClosestFinder<D>::AddRow(int32_t y, const RgbColor* row, int32_t width) {
+  const auto* points = D::ToPoints(row, width, &points_);
+
+  for (int32_t x = 0; x < width; ++x) {
+    const auto& point = points[x];
+
+    for (int32_t cc = 0; cc < kColorCheckerSrgb.ssize(); ++cc) {
+      auto pixel_diff = D::Distance(point, kColorCheckerPoints<D>.at(cc));
+      if (pixel_diff < diff_.at(cc)) {
+        diff_.at(cc) = pixel_diff;
+        closest_.at(cc) = {{{{x, y}}}};
+      }
+    }
+  }
+}
+
+template <class D>
+const ColorCheckerCoords& ClosestFinder<D>::GetClosest() const {
+  return closest_;
+}
+
+
+template <class D>
+LutScorer<D>::LutScorer(const LutBase& lut)
+    : lut_(lut) {
+  diff_.fill(std::numeric_limits<typename D::Value>::max());
+}
+
+template <class D>
+void LutScorer<D>::AddRow(int32_t, const RgbColor* row, int32_t width) {
+  mapped_.resize(static_cast<size_t>(width));
+
+  // Convert each mapped pixel once, rather than once per reference.
+  lut_.MapRow(row, width, mapped_.data());
+  const auto* points = D::ToPoints(mapped_.data(), width, &points_);
+
+  for (int32_t x = 0; x < width; ++x) {
+    const auto& point = points[x];
+
+    for (int32_t cc = 0; cc < kColorCheckerSrgb.ssize(); ++cc) {
+      auto pixel_diff = D::Distance(point, kColorCheckerPoints<D>.at(cc));
+      if (pixel_diff < diff_.at(cc)) {
+        diff_.at(cc) = pixel_diff;
+      }
+    }
+  }
+}
+
+template <class D>
+int32_t LutScorer<D>::GetScore() const {
+  int32_t score = 0;
+  for (const auto& diff : diff_) {
+    score += D::ToScore(diff);
+  }
+  return score;
+}
+
+
+template <class D>
+ColorCheckerAnalysis<D>::ColorCheckerAnalysis(const LutBase& lut)
+    : score(lut) {}
+
+template <class D>
+void ColorCheckerAnalysis<D>::AddRow(int32_t y, const RgbColor* row, int32_t width) {
+  exposure.AddRow(y, row, width);
+  closest.AddRow(y, row, width);
+  score.AddRow(y, row, width);
+}
+
+
+template class ClosestFinder<L1Distance>;
+template class ClosestFinder<Cie76Distance>;
+template class ClosestFinder<Cie2000Distance>;
+template class LutScorer<L1Distance>;
+template class LutScorer<Cie76Distance>;
+template class LutScorer<Cie2000Distance>;
+template struct ColorCheckerAnalysis<L1Distance>;
+template struct ColorCheckerAnalysis<Cie76Distance>;
+template struct ColorCheckerAnalysis<Cie2000Distance>;
@@ -1,97 +1,309 @@
 #pragma once
 
+#include <algorithm>
+#include <cmath>
 #include <cstdint>
+#include <limits>
+#include <memory>
 #include <numeric>
+#include <utility>
+#include <vector>
 
 #include "array.h"
 #include "color.h"
 #include "colors.h"
 #include "coord.h"
+#include "distance.h"
 #include "image.h"
 #include "lut.h"
 #include "minimum.h"
+#include "parallel.h"
+#include "sample.h"
+#include "stats.h"
+#include "telemetry.h"
 
 // Maximum LUT size that has each point adjacent to at least one ColorChecker color.
 typedef Lut3d<4, 3, 3> ColorCheckerLut3d;
 
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wglobal-constructors"
-const Array<RgbColor, 24> kColorCheckerSrgb = {{{
-  {{{{{0x7300, 0x5200, 0x4400}}}}},
-  {{{{{0xc200, 0x9600, 0x8200}}}}},
-  {{{{{0x6200, 0x7a00, 0x9d00}}}}},
-  {{{{{0x5700, 0x6c00, 0x4300}}}}},
-  {{{{{0x8500, 0x8000, 0xb100}}}}},
-  {{{{{0x6700, 0xbd00, 0xaa00}}}}},
-  {{{{{0xd600, 0x7e00, 0x2c00}}}}},
-  {{{{{0x5000, 0x5b00, 0xa600}}}}},
-  {{{{{0xc100, 0x5a00, 0x6300}}}}},
-  {{{{{0x5e00, 0x3c00, 0x6c00}}}}},
-  {{{{{0x9d00, 0xbc00, 0x4000}}}}},
-  {{{{{0xe000, 0xa300, 0x2e00}}}}},
-  {{{{{0x3800, 0x3d00, 0x9600}}}}},
-  {{{{{0x4600, 0x9400, 0x4900}}}}},
-  {{{{{0xaf00, 0x3600, 0x3c00}}}}},
-  {{{{{0xe700, 0xc700, 0x1f00}}}}},
-  {{{{{0xbb00, 0x5600, 0x9500}}}}},
-  {{{{{0x0800, 0x8500, 0xa100}}}}},
-  {{{{{0xf300, 0xf300, 0xf200}}}}},
-  {{{{{0xc800, 0xc800, 0xc800}}}}},
-  {{{{{0xa000, 0xa000, 0xa000}}}}},
-  {{{{{0x7a00, 0x7a00, 0x7900}}}}},
-  {{{{{0x5500, 0x5500, 0x5500}}}}},
-  {{{{{0x3400, 0x3400, 0x3400}}}}},
+constexpr Array<Color<3>, 24> kColorCheckerSrgb = {{{
+  {{{{0x7300, 0x5200, 0x4400}}}},
+  {{{{0xc200, 0x9600, 0x8200}}}},
+  {{{{0x6200, 0x7a00, 0x9d00}}}},
+  {{{{0x5700, 0x6c00, 0x4300}}}},
+  {{{{0x8500, 0x8000, 0xb100}}}},
+  {{{{0x6700, 0xbd00, 0xaa00}}}},
+  {{{{0xd600, 0x7e00, 0x2c00}}}},
+  {{{{0x5000, 0x5b00, 0xa600}}}},
+  {{{{0xc100, 0x5a00, 0x6300}}}},
+  {{{{0x5e00, 0x3c00, 0x6c00}}}},
+  {{{{0x9d00, 0xbc00, 0x4000}}}},
+  {{{{0xe000, 0xa300, 0x2e00}}}},
+  {{{{0x3800, 0x3d00, 0x9600}}}},
+  {{{{0x4600, 0x9400, 0x4900}}}},
+  {{{{0xaf00, 0x3600, 0x3c00}}}},
+  {{{{0xe700, 0xc700, 0x1f00}}}},
+  {{{{0xbb00, 0x5600, 0x9500}}}},
+  {{{{0x0800, 0x8500, 0xa100}}}},
+  {{{{0xf300, 0xf300, 0xf200}}}},
+  {{{{0xc800, 0xc800, 0xc800}}}},
+  {{{{0xa000, 0xa000, 0xa000}}}},
+  {{{{0x7a00, 0x7a00, 0x7900}}}},
+  {{{{0x5500, 0x5500, 0x5500}}}},
+  {{{{0x3400, 0x3400, 0x3400}}}},
 }}};
-#pragma clang diagnostic pop
 
-template <int32_t X, int32_t Y>
-Array<Coord<2>, kColorCheckerSrgb.size()> FindClosest(const Image<X, Y, RgbColor>& image) {
-  Array<Coord<2>, kColorCheckerSrgb.size()> closest;
-  Array<int32_t, kColorCheckerSrgb.size()> diff;
-  diff.fill(INT32_MAX);
+typedef Array<Coord<2>, kColorCheckerSrgb.size()> ColorCheckerCoords;
 
-  for (int32_t y = 0; y < Y; ++y) {
-    const auto& row = image.at(y);
+template <class D, size_t... I>
+constexpr Array<typename D::Point, sizeof...(I)> ToColorCheckerPoints(std::index_sequence<I...>) {
+  return {{{D::ToPoint(kColorCheckerSrgb.at(static_cast<int32_t>(I)))...}}};
+}
 
-    for (int32_t x = 0; x < X; ++x) {
-      const auto& pixel = row.at(x);
+// kColorCheckerSrgb converted for distance policy D, at compile time.
+template <class D>
+constexpr Array<typename D::Point, kColorCheckerSrgb.size()> kColorCheckerPoints =
+  ToColorCheckerPoints<D>(std::make_index_sequence<kColorCheckerSrgb.size()>());
 
-      for (int32_t cc = 0; cc < kColorCheckerSrgb.ssize(); ++cc) {
-        auto pixel_diff = pixel.AbsDiff(kColorCheckerSrgb.at(cc));
-        if (pixel_diff < diff.at(cc)) {
-          diff.at(cc) = pixel_diff;
-          closest.at(cc) = {{{{x, y}}}};
-        }
-      }
-    }
+// Row-at-a-time accumulators, so that analysis can run on rows as they are
+// produced (e.g. by a decoder) as well as over finished images. D is a
+// distance policy from distance.h.
+
+// Tracks the pixel nearest to each ColorChecker color.
+template <class D = L1Distance>
+class ClosestFinder {
+ public:
+  ClosestFinder();
+
+  void AddRow(int32_t y, const RgbColor* row, int32_t width);
+
+  const ColorCheckerCoords& GetClosest() const;
+
+ private:
+  ColorCheckerCoords closest_;
+  Array<typename D::Value, kColorCheckerSrgb.size()> diff_;
+  std::vector<typename D::Point> points_;
+};
+
+// Sum over ColorChecker colors of the distance to the nearest LUT-mapped pixel.
+template <class D = L1Distance>
+class LutScorer {
+ public:
+  explicit LutScorer(const LutBase& lut);
+
+  void AddRow(int32_t y, const RgbColor* row, int32_t width);
+
+  int32_t GetScore() const;
+
+ private:
+  const LutBase& lut_;
+  Array<typename D::Value, kColorCheckerSrgb.size()> diff_;
+  std::vector<Color<3>> mapped_;
+  std::vector<typename D::Point> points_;
+};
+
+// Everything calibration needs from a freshly decoded image, in one pass.
+template <class D = L1Distance>
+struct ColorCheckerAnalysis {
+  explicit ColorCheckerAnalysis(const LutBase& lut);
+
+  void AddRow(int32_t y, const RgbColor* row, int32_t width);
+
+  ExposureStats exposure;
+  ClosestFinder<D> closest;
+  LutScorer<D> score;
+};
+
+// Instantiated in colorchecker.cc
+extern template class ClosestFinder<L1Distance>;
+extern template class ClosestFinder<Cie76Distance>;
+extern template class ClosestFinder<Cie2000Distance>;
+extern template class LutScorer<L1Distance>;
+extern template class LutScorer<Cie76Distance>;
+extern template class LutScorer<Cie2000Distance>;
+extern template struct ColorCheckerAnalysis<L1Distance>;
+extern template struct ColorCheckerAnalysis<Cie76Distance>;
+extern template struct ColorCheckerAnalysis<Cie2000Distance>;
+
+
+// Image-taking functions below accept Image<X, Y, RgbColor> (compile-time
+// dimensions) or DynamicImage<RgbColor>. ScoreLut and OptimizeLut also accept
+// an ImageSet, to calibrate one LUT against several shots jointly.
+
+// One member of a jointly calibrated set, e.g. one exposure of a bracket.
+// Frames are shared, so a frame listed twice is held in memory once.
+template <class I>
+struct WeightedImage {
+  std::shared_ptr<const I> image;
+  int32_t weight;
+};
+
+template <class I>
+using ImageSet = std::vector<WeightedImage<I>>;
+
+template <class D = L1Distance, class I>
+ColorCheckerCoords FindClosest(const I& image) {
+  ScopedTimer timer("FindClosest");
+
+  ClosestFinder<D> finder;
+  for (int32_t y = 0; y < image.GetHeight(); ++y) {
+    finder.AddRow(y, image.GetRow(y), image.GetWidth());
   }
+  return finder.GetClosest();
+}
 
-  return closest;
+template <class D = L1Distance, class I>
+int32_t ScoreLut(const I& image, const LutBase& lut) {
+  ScopedTimer timer("ScoreLut");
+
+  LutScorer<D> scorer(lut);
+  for (int32_t y = 0; y < image.GetHeight(); ++y) {
+    scorer.AddRow(y, image.GetRow(y), image.GetWidth());
+  }
+  return scorer.GetScore();
 }
 
-template <int32_t X, int32_t Y>
-int32_t ScoreLut(const Image<X, Y, RgbColor>& image, const LutBase& lut) {
-  Array<int32_t, kColorCheckerSrgb.size()> diff;
-  diff.fill(INT32_MAX);
-
-  image.ForEach([&diff, &lut](const RgbColor& color) {
-    const auto pixel = lut.MapColor(color);
-    for (int32_t cc = 0; cc < kColorCheckerSrgb.ssize(); ++cc) {
-      auto pixel_diff = pixel.AbsDiff(kColorCheckerSrgb.at(cc));
-      if (pixel_diff < diff.at(cc)) {
-        diff.at(cc) = pixel_diff;
-      }
-    }
+// Weighted sum of the per-image scores. Images are scored in parallel. Sums
+// are 64-bit, since weights are unbounded.
+template <class D = L1Distance, class I>
+int64_t ScoreLut(const ImageSet<I>& images, const LutBase& lut) {
+  ScopedTimer timer("ScoreLut/set");
+
+  const auto num_images = static_cast<int32_t>(images.size());
+  std::vector<int32_t> scores(images.size());
+  ParallelFor(num_images, [&](int32_t i) {
+    scores.at(static_cast<size_t>(i)) = ScoreLut<D>(*images.at(static_cast<size_t>(i)).image, lut);
   });
 
-  return std::accumulate(diff.begin(), diff.end(), 0);
+  int64_t score = 0;
+  for (int32_t i = 0; i < num_images; ++i) {
+    score += static_cast<int64_t>(scores.at(static_cast<size_t>(i))) * images.at(static_cast<size_t>(i)).weight;
+  }
+  return score;
+}
+
+// Scores the first pixels of sample; see PixelSample::GetPrefixSize().
+template <class D = L1Distance>
+int32_t ScoreLut(const PixelSample& sample, const LutBase& lut, int32_t pixels) {
+  constexpr int32_t kChunk = 4096;
+
+  LutScorer<D> scorer(lut);
+  const auto size = sample.GetPrefixSize(pixels);
+  for (int32_t start = 0; start < size; start += kChunk) {
+    scorer.AddRow(0, sample.GetPixels() + start, std::min(kChunk, size - start));
+  }
+  return scorer.GetScore();
 }
 
-template <int32_t X, int32_t Y>
-std::unique_ptr<Image<X, Y, RgbColor>> HighlightClosest(const Image<X, Y, RgbColor>& image) {
-  auto out = std::make_unique<Image<X, Y, RgbColor>>(image);
 
-  auto closest = FindClosest(*out);
+// OptimizeLut searches each LUT channel over this range.
+constexpr int32_t kLutSearchMin = -UINT16_MAX;
+constexpr int32_t kLutSearchMax = UINT16_MAX * 2;
+
+// Approximate scoring for OptimizeLut. While FindPossibleMinimum's range is
+// wide, its test points are far apart, so probes are scored on a PixelSample
+// of each image, growing with the square root of how far the range has
+// narrowed.
+//
+// Sample scores are never below exact scores, since each ColorChecker color's
+// nearest pixel is searched for among fewer pixels; a larger sample is never
+// further off than a smaller one.
+struct ScoreSampling {
+  // false scores every probe exactly.
+  bool enabled;
+  uint32_t seed;
+  // Pixels per image sampled while the whole search range is open.
+  int32_t min_pixels;
+  // Probes that would need more pixels than this, or than half of an image,
+  // are scored exactly.
+  int32_t max_pixels;
+  // Ranges at most this wide are scored exactly; FindPossibleMinimum's final
+  // step is at most 8 wide. Raising it keeps the LUT closer to what exact
+  // scoring would find, at the cost of speed.
+  int32_t exact_width;
+};
+
+constexpr ScoreSampling kExactScoring = {false, 0, 0, 0, 0};
+constexpr ScoreSampling kSampledScoring = {true, 1, 4096, 1 << 18, 8};
+
+struct WeightedPixelSample {
+  PixelSample sample;
+  int32_t weight;
+};
+
+// Past half of the image, a sample saves too little over exact scoring.
+template <class I>
+int32_t GetMaxSamplePixels(const I& image, const ScoreSampling& sampling) {
+  return std::min(sampling.max_pixels, image.GetWidth() * image.GetHeight() / 2);
+}
+
+template <class I>
+std::vector<WeightedPixelSample> MakePixelSamples(const I& image, const ScoreSampling& sampling) {
+  std::vector<WeightedPixelSample> samples;
+  if (sampling.enabled) {
+    samples.push_back({PixelSample(image, GetMaxSamplePixels(image, sampling), sampling.seed), 1});
+  }
+  return samples;
+}
+
+template <class I>
+std::vector<WeightedPixelSample> MakePixelSamples(const ImageSet<I>& images, const ScoreSampling& sampling) {
+  std::vector<WeightedPixelSample> samples;
+  if (sampling.enabled) {
+    for (size_t i = 0; i < images.size(); ++i) {
+      // Distinct seeds, so duplicate frames still contribute distinct pixels.
+      const auto seed = sampling.seed + static_cast<uint32_t>(i);
+      const auto& image = *images.at(i).image;
+      samples.push_back({PixelSample(image, GetMaxSamplePixels(image, sampling), seed), images.at(i).weight});
+    }
+  }
+  return samples;
+}
+
+// Scores a probe of a FindPossibleMinimumCoarseToFine search of the given
+// width; image is an image or ImageSet, samples are from MakePixelSamples().
+template <class D = L1Distance, class I>
+int64_t ScoreLutForRange(const I& image, const std::vector<WeightedPixelSample>& samples, const ScoreSampling& sampling, const LutBase& lut, int32_t width) {
+  if (!sampling.enabled || width <= sampling.exact_width) {
+    return ScoreLut<D>(image, lut);
+  }
+
+  const auto narrowing = static_cast<double>(kLutSearchMax - kLutSearchMin + 1) / width;
+  const auto pixels = static_cast<double>(sampling.min_pixels) * std::sqrt(narrowing);
+  for (const auto& sample : samples) {
+    if (pixels > sample.sample.GetSize()) {
+      return ScoreLut<D>(image, lut);
+    }
+  }
+
+  ScopedTimer timer("ScoreLut/sampled");
+
+  int64_t score = 0;
+  for (const auto& sample : samples) {
+    score += static_cast<int64_t>(ScoreLut<D>(sample.sample, lut, static_cast<int32_t>(pixels))) * sample.weight;
+  }
+  return score;
+}
+
+// Records how far the smallest sample's score is above the exact score, for
+// the LUT OptimizeLut settled on. This bounds the error of every sampled probe
+// at that LUT. Only computed when telemetry is on.
+template <class D = L1Distance, class I>
+void RecordSampleError(const I& image, const std::vector<WeightedPixelSample>& samples, const ScoreSampling& sampling, const LutBase& lut) {
+  if (!sampling.enabled || !Telemetry::IsEnabled()) {
+    return;
+  }
+
+  int64_t sampled = 0;
+  for (const auto& sample : samples) {
+    sampled += static_cast<int64_t>(ScoreLut<D>(sample.sample, lut, sampling.min_pixels)) * sample.weight;
+  }
+  Telemetry::RecordCounter("OptimizeLut.sample_error", sampled - ScoreLut<D>(image, lut));
+}
+
+template <class I>
+std::unique_ptr<I> HighlightClosest(const I& image, const ColorCheckerCoords& closest) {
+  auto out = std::make_unique<I>(image);
+
   for (int32_t cc = 0; cc < kColorCheckerSrgb.ssize(); ++cc) {
     const auto& coord = closest.at(cc);
     const auto& color = kColorCheckerSrgb.at(cc);
@@ -104,9 +316,46 @@ std::unique_ptr<Image<X, Y, RgbColor>> HighlightClosest(const Image<X, Y, RgbCol
   return out;
 }
 
-template <int32_t LUT_X, int32_t LUT_Y, int32_t LUT_Z, int32_t IMG_X, int32_t IMG_Y>
-int32_t OptimizeLut(const ImageColorBase<RgbColor>& image, Lut3d<LUT_X, LUT_Y, LUT_Z>* lut) {
-  auto snapshot = *lut;
+template <class D = L1Distance, class I>
+std::unique_ptr<I> HighlightClosest(const I& image) {
+  return HighlightClosest(image, FindClosest<D>(image));
+}
+
+// Both OptimizeLut overloads are Jacobi-style: every search reads only the
+// LUT as it was at the start of the round, so all (control point, channel)
+// searches of a round are independent and run in parallel. Updates are then
+// applied in order, so the result doesn't depend on the number of threads.
+
+template <class D = L1Distance, int32_t LUT_X, int32_t LUT_Y, int32_t LUT_Z, class I>
+int32_t OptimizeLut(const I& image, Lut3d<LUT_X, LUT_Y, LUT_Z>* lut, bool verbose = false, const ScoreSampling& sampling = kExactScoring) {
+  static_assert(D::kOptimizable, "Distance policy too slow for OptimizeLut; use it to evaluate with ScoreLut");
+  ScopedTimer timer("OptimizeLut");
+
+  constexpr int32_t kChannels = 3;
+  const auto samples = MakePixelSamples(image, sampling);
+  const auto snapshot = *lut;
+
+  Array<int32_t, LUT_X * LUT_Y * LUT_Z * kChannels> mins;
+  ParallelFor(mins.ssize(), [&](int32_t task) {
+    const int32_t c = task % kChannels;
+    const int32_t z = task / kChannels % LUT_Z;
+    const int32_t y = task / kChannels / LUT_Z % LUT_Y;
+    const int32_t x = task / kChannels / LUT_Z / LUT_Y;
+
+    auto& min = mins.at(task);
+    min = FindPossibleMinimumCoarseToFine<int32_t, int64_t, 8>(
+      kLutSearchMin, kLutSearchMax,
+      [&image, &samples, &sampling, &snapshot, x, y, z, c](int32_t val, int32_t width) {
+        auto test_lut = snapshot;
+        test_lut.at(x).at(y).at(z).at(c) = val;
+        return ScoreLutForRange<D>(image, samples, sampling, test_lut, width);
+      });
+
+    auto test_lut = snapshot;
+    test_lut.at(x).at(y).at(z).at(c) = min;
+    RecordSampleError<D>(image, samples, sampling, test_lut);
+  });
+
   int32_t diff = 0;
 
   for (int32_t x = 0; x < LUT_X; ++x) {
@@ -118,22 +367,20 @@ int32_t OptimizeLut(const ImageColorBase<RgbColor>& image, Lut3d<LUT_X, LUT_Y, L
       for (int32_t z = 0; z < LUT_Z; ++z) {
         auto& color = row.at(z);
 
-        std::cout << Coord<3>{{{{x, y, z}}}} << std::endl;
+        if (verbose) {
+          std::cout << Coord<3>{{{{x, y, z}}}} << "\n";
+        }
 
-        for (int32_t c = 0; c < color.size(); ++c) {
+        for (int32_t c = 0; c < kChannels; ++c) {
           auto& channel = color.at(c);
+          const auto min = mins.at(((x * LUT_Y + y) * LUT_Z + z) * kChannels + c);
 
-          auto min = FindPossibleMinimum<int32_t, int32_t, 8>(
-            -UINT16_MAX, UINT16_MAX * 2,
-            [&image, &snapshot, x, y, z, c](int32_t val) {
-              auto test_lut = snapshot;
-              test_lut.at(x).at(y).at(z).at(c) = val;
-              return ScoreLut(image, test_lut);
-            });
           // Magic value of 8 is the number of points making up a square, so the number
           // of points that control any given given LUT mapping.
           auto new_value = Interpolate(channel, min, INT32_C(1), INT32_C(8));
-          std::cout << "\tC" << c << ": " << channel << " -> " << new_value << " (interpolated from " << min << ")" << std::endl;
+          if (verbose) {
+            std::cout << "\tC" << c << ": " << channel << " -> " << new_value << " (interpolated from " << min << ")\n";
+          }
           diff += AbsDiff(channel, new_value);
           channel = new_value;
         }
@@ -141,37 +388,63 @@ int32_t OptimizeLut(const ImageColorBase<RgbColor>& image, Lut3d<LUT_X, LUT_Y, L
     }
   }
 
+  Telemetry::RecordCounter("OptimizeLut.diff", diff);
   return diff;
 }
 
-template <int32_t LUT_X, int32_t IMG_X, int32_t IMG_Y>
-int32_t OptimizeLut(const Image<IMG_X, IMG_Y, RgbColor>& image, Lut1d<LUT_X>* lut) {
-  auto snapshot = *lut;
+// Accepts Lut1d or HsvLut1d.
+template <class D = L1Distance, template <int32_t> class L, int32_t LUT_X, class I>
+int32_t OptimizeLut(const I& image, L<LUT_X>* lut, bool verbose = false, const ScoreSampling& sampling = kExactScoring) {
+  static_assert(D::kOptimizable, "Distance policy too slow for OptimizeLut; use it to evaluate with ScoreLut");
+  ScopedTimer timer("OptimizeLut");
+
+  constexpr int32_t kChannels = 3;
+  const auto samples = MakePixelSamples(image, sampling);
+  const auto snapshot = *lut;
+
+  Array<int32_t, LUT_X * kChannels> mins;
+  ParallelFor(mins.ssize(), [&](int32_t task) {
+    const int32_t c = task % kChannels;
+    const int32_t x = task / kChannels;
+
+    auto& min = mins.at(task);
+    min = FindPossibleMinimumCoarseToFine<int32_t, int64_t, 8>(
+      kLutSearchMin, kLutSearchMax,
+      [&image, &samples, &sampling, &snapshot, x, c](int32_t val, int32_t width) {
+        auto test_lut = snapshot;
+        test_lut.at(x).at(c) = val;
+        return ScoreLutForRange<D>(image, samples, sampling, test_lut, width);
+      });
+
+    auto test_lut = snapshot;
+    test_lut.at(x).at(c) = min;
+    RecordSampleError<D>(image, samples, sampling, test_lut);
+  });
+
   int32_t diff = 0;
 
   for (int32_t x = 0; x < LUT_X; ++x) {
     auto& color = lut->at(x);
 
-    std::cout << Coord<1>{{{{x}}}} << std::endl;
+    if (verbose) {
+      std::cout << Coord<1>{{{{x}}}} << "\n";
+    }
 
-    for (int32_t c = 0; c < color.ssize(); ++c) {
+    for (int32_t c = 0; c < kChannels; ++c) {
       auto& channel = color.at(c);
+      const auto min = mins.at(x * kChannels + c);
 
-      auto min = FindPossibleMinimum<int32_t, int32_t, 8>(
-        -UINT16_MAX, UINT16_MAX * 2,
-        [&image, &snapshot, x, c](int32_t val) {
-          auto test_lut = snapshot;
-          test_lut.at(x).at(c) = val;
-          return ScoreLut(image, test_lut);
-        });
       // Magic value of 8 is the number of points making up a square, so the number
       // of points that control any given given LUT mapping.
       auto new_value = Interpolate(channel, min, INT32_C(1), INT32_C(8));
-      std::cout << "\tC" << c << ": " << channel << " -> " << new_value << " (interpolated from " << min << ")" << std::endl;
+      if (verbose) {
+        std::cout << "\tC" << c << ": " << channel << " -> " << new_value << " (interpolated from " << min << ")\n";
+      }
       diff += AbsDiff(channel, new_value);
       channel = new_value;
     }
   }
 
+  Telemetry::RecordCounter("OptimizeLut.diff", diff);
   return diff;
 }
@@ -0,0 +1,256 @@
+#include "demosaic.h"
+
+#include <memory>
+#include <vector>
+
+#include "parallel.h"
+#include "telemetry.h"
+
+namespace {
+
+constexpr int32_t kBandRows = 64;
+// Context needed on each side of a pixel by the widest (5x5) kernel.
+constexpr int32_t kHalo = 2;
+
+// Unpacked rows for one band, plus kHalo rows above and below. Each row has
+// kHalo mirrored columns on each side, so kernels never bounds check.
+class BandBuffer {
+ public:
+  BandBuffer(int32_t width, int32_t rows);
+
+  int32_t* GetRow(int32_t row);
+
+  void Fill(const PiRawMode& mode, const uint8_t* data, UnpackRawRowFunc unpack, int32_t y_start, int32_t y_end);
+
+ private:
+  // Mirrors an out-of-range index back in range, preserving Bayer parity.
+  static int32_t Reflect(int32_t i, int32_t size);
+
+  int32_t width_;
+  int32_t stride_;
+  std::vector<int32_t> values_;
+};
+
+BandBuffer::BandBuffer(int32_t width, int32_t rows)
+    : width_(width),
+      stride_(width + kHalo * 2),
+      values_(static_cast<size_t>(stride_) * static_cast<size_t>(rows + kHalo * 2)) {}
+
+int32_t* BandBuffer::GetRow(int32_t row) {
+  return values_.data() + (row + kHalo) * stride_ + kHalo;
+}
+
+void BandBuffer::Fill(const PiRawMode& mode, const uint8_t* data, UnpackRawRowFunc unpack, int32_t y_start, int32_t y_end) {
+  for (int32_t y = y_start - kHalo; y < y_end + kHalo; ++y) {
+    auto* row = GetRow(y - y_start);
+    unpack(data + Reflect(y, mode.y) * mode.row_bytes, mode.x, row);
+    for (int32_t x = 1; x <= kHalo; ++x) {
+      row[-x] = row[x];
+      row[width_ - 1 + x] = row[width_ - 1 - x];
+    }
+  }
+}
+
+int32_t BandBuffer::Reflect(int32_t i, int32_t size) {
+  if (i < 0) {
+    return -i;
+  }
+  if (i >= size) {
+    return 2 * (size - 1) - i;
+  }
+  return i;
+}
+
+int32_t Clamp(int32_t value) {
+  return std::max(kMinColor, std::min(kMaxColor, value));
+}
+
+// Neighborhood of one raw site; (dy, dx) relative to center.
+class Site {
+ public:
+  Site(int32_t* const* rows, int32_t x);
+
+  int32_t At(int32_t dy, int32_t dx) const;
+
+  int32_t Center() const;
+  // N + S + E + W
+  int32_t Cross() const;
+  // NE + NW + SE + SW
+  int32_t Diagonal() const;
+  // E + W
+  int32_t Horizontal() const;
+  // N + S
+  int32_t Vertical() const;
+  // E2 + W2
+  int32_t Horizontal2() const;
+  // N2 + S2
+  int32_t Vertical2() const;
+
+ private:
+  int32_t* const* rows_;
+  int32_t x_;
+};
+
+Site::Site(int32_t* const* rows, int32_t x)
+    : rows_(rows),
+      x_(x) {}
+
+int32_t Site::At(int32_t dy, int32_t dx) const {
+  return rows_[kHalo + dy][x_ + dx];
+}
+
+int32_t Site::Center() const {
+  return At(0, 0);
+}
+
+int32_t Site::Cross() const {
+  return Horizontal() + Vertical();
+}
+
+int32_t Site::Diagonal() const {
+  return At(-1, -1) + At(-1, 1) + At(1, -1) + At(1, 1);
+}
+
+int32_t Site::Horizontal() const {
+  return At(0, -1) + At(0, 1);
+}
+
+int32_t Site::Vertical() const {
+  return At(-1, 0) + At(1, 0);
+}
+
+int32_t Site::Horizontal2() const {
+  return At(0, -2) + At(0, 2);
+}
+
+int32_t Site::Vertical2() const {
+  return At(-2, 0) + At(2, 0);
+}
+
+// Each kernel returns (same color as site, green, opposite color). For green
+// sites, "same" is the color sharing the row.
+template <Demosaic D>
+struct Kernel;
+
+template <>
+struct Kernel<Demosaic::kBilinear> {
+  static void RedBlue(const Site& site, int32_t* same, int32_t* green, int32_t* opposite) {
+    *same = site.Center();
+    *green = site.Cross() / 4;
+    *opposite = site.Diagonal() / 4;
+  }
+
+  static void Green(const Site& site, int32_t* row_color, int32_t* green, int32_t* column_color) {
+    *row_color = site.Horizontal() / 2;
+    *green = site.Center();
+    *column_color = site.Vertical() / 2;
+  }
+};
+
+// Malvar, He, Cutler: "High-quality linear interpolation for demosaicing of
+// Bayer-patterned color images", ICASSP 2004. Coefficients are doubled
+// (/16 rather than /8) to keep the half-weights integral.
+template <>
+struct Kernel<Demosaic::kMalvar> {
+  static void RedBlue(const Site& site, int32_t* same, int32_t* green, int32_t* opposite) {
+    const auto center = site.Center();
+    const auto outer = site.Horizontal2() + site.Vertical2();
+    *same = center;
+    *green = Clamp((8 * center + 4 * site.Cross() - 2 * outer) / 16);
+    *opposite = Clamp((12 * center + 4 * site.Diagonal() - 3 * outer) / 16);
+  }
+
+  static void Green(const Site& site, int32_t* row_color, int32_t* green, int32_t* column_color) {
+    const auto center = site.Center();
+    const auto diagonal = site.Diagonal();
+    *row_color = Clamp((10 * center + 8 * site.Horizontal() - 2 * site.Horizontal2() - 2 * diagonal + site.Vertical2()) / 16);
+    *green = center;
+    *column_color = Clamp((10 * center + 8 * site.Vertical() - 2 * site.Vertical2() - 2 * diagonal + site.Horizontal2()) / 16);
+  }
+};
+
+// Processes one output row. rows points at the unpacked rows y - kHalo through
+// y + kHalo. Each (row, column) parity is a separate loop over one site type.
+template <Demosaic D>
+void DemosaicRow(int32_t* const* rows, int32_t width, int32_t red_x, bool red_row, RgbColor* out) {
+  // Columns with the same parity as red hold red (red rows) or green (blue rows).
+  if (red_row) {
+    for (int32_t x = red_x; x < width; x += 2) {
+      auto& pixel = out[x];
+      Kernel<D>::RedBlue(Site(rows, x), &pixel.at(0), &pixel.at(1), &pixel.at(2));
+    }
+    for (int32_t x = 1 - red_x; x < width; x += 2) {
+      auto& pixel = out[x];
+      Kernel<D>::Green(Site(rows, x), &pixel.at(0), &pixel.at(1), &pixel.at(2));
+    }
+  } else {
+    for (int32_t x = red_x; x < width; x += 2) {
+      auto& pixel = out[x];
+      Kernel<D>::Green(Site(rows, x), &pixel.at(2), &pixel.at(1), &pixel.at(0));
+    }
+    for (int32_t x = 1 - red_x; x < width; x += 2) {
+      auto& pixel = out[x];
+      Kernel<D>::RedBlue(Site(rows, x), &pixel.at(2), &pixel.at(1), &pixel.at(0));
+    }
+  }
+}
+
+template <Demosaic D>
+void DemosaicBand(const PiRawMode& mode, const uint8_t* data, UnpackRawRowFunc unpack, int32_t y_start, int32_t y_end, BandBuffer* buffer, DynamicImage<RgbColor>* out, const RowCallback& map_row) {
+  const int32_t red_x = mode.bayer == BayerOrder::kRggb || mode.bayer == BayerOrder::kGbrg ? 0 : 1;
+  const int32_t red_y = mode.bayer == BayerOrder::kRggb || mode.bayer == BayerOrder::kGrbg ? 0 : 1;
+
+  buffer->Fill(mode, data, unpack, y_start, y_end);
+
+  for (int32_t y = y_start; y < y_end; ++y) {
+    int32_t* rows[kHalo * 2 + 1];
+    for (int32_t dy = -kHalo; dy <= kHalo; ++dy) {
+      rows[dy + kHalo] = buffer->GetRow(y - y_start + dy);
+    }
+    DemosaicRow<D>(rows, mode.x, red_x, (y % 2) == red_y, out->GetRow(y));
+    if (map_row) {
+      map_row(y, out->GetRow(y), mode.x);
+    }
+  }
+}
+
+typedef void (*DemosaicBandFunc)(const PiRawMode&, const uint8_t*, UnpackRawRowFunc, int32_t, int32_t, BandBuffer*, DynamicImage<RgbColor>*, const RowCallback&);
+
+DemosaicBandFunc GetDemosaicBand(Demosaic demosaic) {
+  switch (demosaic) {
+    case Demosaic::kBilinear:
+      return &DemosaicBand<Demosaic::kBilinear>;
+    case Demosaic::kMalvar:
+      return &DemosaicBand<Demosaic::kMalvar>;
+    case Demosaic::kBin2x2:
+      assert(false);
+      return nullptr;
+  }
+}
+
+}  // namespace
+
+void DemosaicRaw(const PiRawMode& mode, const std::string_view& raw, Demosaic demosaic, DynamicImage<RgbColor>* out, const RowCallback& map_row) {
+  assert(mode.x > kHalo * 2 && mode.y > kHalo * 2);
+  assert(out->GetWidth() == mode.x && out->GetHeight() == mode.y);
+
+  ScopedTimer timer("DemosaicRaw");
+
+  const auto* data = reinterpret_cast<const uint8_t*>(raw.data());
+  const auto unpack = GetUnpackRawRow(mode.depth);
+  const auto band_func = GetDemosaicBand(demosaic);
+  const int32_t num_bands = (mode.y + kBandRows - 1) / kBandRows;
+
+  auto* pool = ThreadPool::GetDefault();
+  // One per pool thread, allocated by the first band it runs.
+  std::vector<std::unique_ptr<BandBuffer>> buffers(static_cast<size_t>(pool->GetNumThreads()));
+
+  pool->ParallelFor(num_bands, [&](int32_t band) {
+    auto& buffer = buffers.at(static_cast<size_t>(ThreadPool::GetThreadIndex()));
+    if (!buffer) {
+      buffer = std::make_unique<BandBuffer>(mode.x, kBandRows);
+    }
+    const auto y_start = band * kBandRows;
+    band_func(mode, data, unpack, y_start, std::min(mode.y, y_start + kBandRows), buffer.get(), out, map_row);
+  });
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include "image.h"
+#include "piraw.h"
+
+// Full-resolution demosaic of a packed raw buffer into out, which must be
+// mode.x by mode.y. Work is split into row bands across the default
+// ThreadPool; each band unpacks only its own rows plus a small halo of
+// context. map_row, if set, runs on each row as soon as it's written, while
+// it's still in cache; bands run concurrently, so calls may overlap and come
+// out of order.
+void DemosaicRaw(const PiRawMode& mode, const std::string_view& raw, Demosaic demosaic, DynamicImage<RgbColor>* out, const RowCallback& map_row = nullptr);
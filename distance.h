@@ -0,0 +1,118 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "color.h"
+#include "lab.h"
+
+// Distance policies for the scoring templates (ClosestFinder, LutScorer,
+// ScoreLut, OptimizeLut).
+//
+// Each pixel is converted to a Point once with ToPoints(), which returns in
+// itself when Point is Color<3>, and otherwise converts into scratch;
+// references are converted at compile time with ToPoint(). Distance() only has
+// to order candidates correctly; ToScore() turns the winning distance into
+// score units. kOptimizable policies are cheap enough for OptimizeLut's inner
+// loop.
+
+// Sum of absolute differences of 16-bit sRGB channels.
+struct L1Distance {
+  typedef Color<3> Point;
+  typedef int32_t Value;
+  static constexpr bool kOptimizable = true;
+
+  static constexpr Point ToPoint(const Color<3>& color);
+  static const Point* ToPoints(const Color<3>* in, int32_t width, std::vector<Point>* scratch);
+  static Value Distance(const Point& a, const Point& b);
+  static int32_t ToScore(Value value);
+};
+
+// Scores from perceptual policies are in hundredths of a delta E.
+constexpr float kDeltaEScoreScale = 100;
+
+// CIE76 delta E: Euclidean distance in CIELAB.
+struct Cie76Distance {
+  typedef LabColor Point;
+  // Squared delta E; same ordering, without a sqrt per comparison.
+  typedef float Value;
+  static constexpr bool kOptimizable = true;
+
+  static constexpr Point ToPoint(const Color<3>& color);
+  static const Point* ToPoints(const Color<3>* in, int32_t width, std::vector<Point>* scratch);
+  static Value Distance(const Point& a, const Point& b);
+  static int32_t ToScore(Value value);
+};
+
+// CIEDE2000 delta E. About 100x the cost of L1 per comparison, since its
+// weighting terms depend on both colors; only for evaluating results.
+struct Cie2000Distance {
+  typedef LabColor Point;
+  typedef float Value;
+  static constexpr bool kOptimizable = false;
+
+  static constexpr Point ToPoint(const Color<3>& color);
+  static const Point* ToPoints(const Color<3>* in, int32_t width, std::vector<Point>* scratch);
+  static Value Distance(const Point& a, const Point& b);
+  static int32_t ToScore(Value value);
+};
+
+
+constexpr L1Distance::Point L1Distance::ToPoint(const Color<3>& color) {
+  return color;
+}
+
+inline const L1Distance::Point* L1Distance::ToPoints(const Color<3>* in, int32_t, std::vector<Point>*) {
+  return in;
+}
+
+inline L1Distance::Value L1Distance::Distance(const Point& a, const Point& b) {
+  return a.AbsDiff(b);
+}
+
+inline int32_t L1Distance::ToScore(Value value) {
+  return value;
+}
+
+
+constexpr Cie76Distance::Point Cie76Distance::ToPoint(const Color<3>& color) {
+  return SrgbToLab(color);
+}
+
+inline const Cie76Distance::Point* Cie76Distance::ToPoints(const Color<3>* in, int32_t width, std::vector<Point>* scratch) {
+  scratch->resize(static_cast<size_t>(width));
+  SrgbToLabRow(in, width, scratch->data());
+  return scratch->data();
+}
+
+inline Cie76Distance::Value Cie76Distance::Distance(const Point& a, const Point& b) {
+  const auto l = a.at(0) - b.at(0);
+  const auto aa = a.at(1) - b.at(1);
+  const auto bb = a.at(2) - b.at(2);
+  return l * l + aa * aa + bb * bb;
+}
+
+inline int32_t Cie76Distance::ToScore(Value value) {
+  return static_cast<int32_t>(std::lround(std::sqrt(value) * kDeltaEScoreScale));
+}
+
+
+constexpr Cie2000Distance::Point Cie2000Distance::ToPoint(const Color<3>& color) {
+  return SrgbToLab(color);
+}
+
+inline const Cie2000Distance::Point* Cie2000Distance::ToPoints(const Color<3>* in, int32_t width, std::vector<Point>* scratch) {
+  scratch->resize(static_cast<size_t>(width));
+  SrgbToLabRow(in, width, scratch->data());
+  return scratch->data();
+}
+
+inline Cie2000Distance::Value Cie2000Distance::Distance(const Point& a, const Point& b) {
+  return Cie2000(a, b);
+}
+
+inline int32_t Cie2000Distance::ToScore(Value value) {
+  return static_cast<int32_t>(std::lround(value * kDeltaEScoreScale));
+}
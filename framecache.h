@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "util.h"
+
+// Shares decoded frames between inputs naming the same file, e.g. the same
+// shot listed twice in a calibration set, so each is read, decoded and held
+// in memory once. Keyed by the file's device and inode, which are exact and
+// cost a stat() rather than a read of the whole file.
+template <class I>
+class FrameCache {
+ public:
+  typedef std::function<std::unique_ptr<I>()> DecodeFunc;
+
+  // Runs decode() unless filename's file was seen before; sets *decoded to
+  // whether it ran. Failed decodes (nullptr) aren't cached, nor are files
+  // that can't be stat()ed.
+  std::shared_ptr<const I> Get(const std::string& filename, const DecodeFunc& decode, bool* decoded = nullptr);
+
+  int32_t GetNumFrames() const;
+
+ private:
+  std::map<FileId, std::shared_ptr<const I>> frames_;
+};
+
+template <class I>
+std::shared_ptr<const I> FrameCache<I>::Get(const std::string& filename, const DecodeFunc& decode, bool* decoded) {
+  FileId id;
+  const bool cacheable = GetFileId(filename, &id);
+  if (cacheable) {
+    auto iter = frames_.find(id);
+    if (iter != frames_.end()) {
+      if (decoded) {
+        *decoded = false;
+      }
+      return iter->second;
+    }
+  }
+
+  if (decoded) {
+    *decoded = true;
+  }
+  std::shared_ptr<const I> frame = decode();
+  if (frame && cacheable) {
+    frames_.emplace(id, frame);
+  }
+  return frame;
+}
+
+template <class I>
+int32_t FrameCache<I>::GetNumFrames() const {
+  return static_cast<int32_t>(frames_.size());
+}
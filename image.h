@@ -4,10 +4,18 @@
 #include <png.h>
 
 #include <cassert>
+#include <cstdlib>
+#include <memory>
+#include <vector>
 
 #include "array.h"
 #include "color.h"
 #include "coord.h"
+#include "intmath.h"
+
+// zlib compression level for PNG output: 0 (none) to 9 (smallest), or -1
+// for zlib's default.
+constexpr int32_t kPngDefaultCompression = -1;
 
 class ImageBase {};
 
@@ -22,9 +30,17 @@ struct ImageColorBase : public ImageBase {
 };
 
 
+// Fixed-size image; dimensions are compile-time constants, so loops over it
+// fold. Large instances must live on the heap.
 template <int32_t X, int32_t Y, class C>
 class Image : public Array<Array<C, X>, Y>, ImageColorBase<C> {
  public:
+  constexpr int32_t GetWidth() const;
+  constexpr int32_t GetHeight() const;
+
+  constexpr const C* GetRow(int32_t y) const;
+  constexpr C* GetRow(int32_t y);
+
   constexpr const C& GetPixel(const Coord<2>& coord) const;
 
   void ForEach(std::function<void(const C&)> callback) const override;
@@ -35,9 +51,87 @@ class Image : public Array<Array<C, X>, Y>, ImageColorBase<C> {
   void DrawRectangle(const Coord<2>& start, const C& color, int32_t x_length, int32_t y_length);
   void DrawSquare(const Coord<2>& start, const C& color, int32_t length);
 
-  std::string ToPng();
+  std::string ToPng(int32_t compression_level = kPngDefaultCompression) const;
 };
 
+
+// Runtime-sized image with heap-backed storage. Rows are padded so that each
+// one starts on a kAlignment boundary.
+template <class C>
+class DynamicImage : public ImageColorBase<C> {
+ public:
+  DynamicImage(int32_t width, int32_t height);
+  DynamicImage(const DynamicImage<C>& src);
+  DynamicImage(DynamicImage<C>&& src) = default;
+
+  int32_t GetWidth() const;
+  int32_t GetHeight() const;
+
+  const C* GetRow(int32_t y) const;
+  C* GetRow(int32_t y);
+
+  const C& GetPixel(const Coord<2>& coord) const;
+
+  void ForEach(std::function<void(const C&)> callback) const override;
+
+  void SetPixel(const Coord<2>& coord, const C& color);
+  void DrawXLine(const Coord<2>& start, const C& color, int32_t length);
+  void DrawYLine(const Coord<2>& start, const C& color, int32_t length);
+  void DrawRectangle(const Coord<2>& start, const C& color, int32_t x_length, int32_t y_length);
+  void DrawSquare(const Coord<2>& start, const C& color, int32_t length);
+
+  std::string ToPng(int32_t compression_level = kPngDefaultCompression) const;
+
+ private:
+  static constexpr size_t kAlignment = 64;
+
+  struct Free {
+    void operator()(C* ptr) const;
+  };
+
+  static int32_t GetStride(int32_t width);
+  static std::unique_ptr<C[], Free> Allocate(int32_t stride, int32_t height);
+
+  int32_t width_;
+  int32_t height_;
+  // In pixels
+  int32_t stride_;
+  std::unique_ptr<C[], Free> pixels_;
+};
+
+
+// Returns an uninitialized image with the same dimensions as the argument.
+template <int32_t X, int32_t Y, class C>
+std::unique_ptr<Image<X, Y, C>> MakeImageLike(const Image<X, Y, C>& image);
+
+template <class C>
+std::unique_ptr<DynamicImage<C>> MakeImageLike(const DynamicImage<C>& image);
+
+// Image-type-agnostic PNG encoder; used by both Image and DynamicImage.
+template <class I>
+std::string WritePng(const I& image, int32_t compression_level = kPngDefaultCompression);
+
+
+template <int32_t X, int32_t Y, class C>
+constexpr int32_t Image<X, Y, C>::GetWidth() const {
+  return X;
+}
+
+template <int32_t X, int32_t Y, class C>
+constexpr int32_t Image<X, Y, C>::GetHeight() const {
+  return Y;
+}
+
+template <int32_t X, int32_t Y, class C>
+constexpr const C* Image<X, Y, C>::GetRow(int32_t y) const {
+  return this->at(y).data();
+}
+
+template <int32_t X, int32_t Y, class C>
+constexpr C* Image<X, Y, C>::GetRow(int32_t y) {
+  return this->at(y).data();
+}
+
 template <int32_t X, int32_t Y, class C>
 constexpr const C& Image<X, Y, C>::GetPixel(const Coord<2>& coord) const {
   return this->at(coord.at(1)).at(coord.at(0));
@@ -88,13 +182,148 @@ void Image<X, Y, C>::DrawSquare(const Coord<2>& start, const C& color, int32_t l
   DrawRectangle(start, color, length, length);
 }
 
+template <int32_t X, int32_t Y, class C>
+std::string Image<X, Y, C>::ToPng(int32_t compression_level) const {
+  return WritePng(*this, compression_level);
+}
+
+
+template <class C>
+DynamicImage<C>::DynamicImage(int32_t width, int32_t height)
+    : width_(width),
+      height_(height),
+      stride_(GetStride(width)),
+      pixels_(Allocate(stride_, height)) {}
+
+template <class C>
+DynamicImage<C>::DynamicImage(const DynamicImage<C>& src)
+    : ImageColorBase<C>(src),
+      width_(src.width_),
+      height_(src.height_),
+      stride_(src.stride_),
+      pixels_(Allocate(stride_, height_)) {
+  std::copy(src.pixels_.get(), src.pixels_.get() + stride_ * height_, pixels_.get());
+}
+
+template <class C>
+int32_t DynamicImage<C>::GetWidth() const {
+  return width_;
+}
+
+template <class C>
+int32_t DynamicImage<C>::GetHeight() const {
+  return height_;
+}
+
+template <class C>
+const C* DynamicImage<C>::GetRow(int32_t y) const {
+  assert(y >= 0 && y < height_);
+  return pixels_.get() + y * stride_;
+}
+
+template <class C>
+C* DynamicImage<C>::GetRow(int32_t y) {
+  assert(y >= 0 && y < height_);
+  return pixels_.get() + y * stride_;
+}
+
+template <class C>
+const C& DynamicImage<C>::GetPixel(const Coord<2>& coord) const {
+  assert(coord.at(0) >= 0 && coord.at(0) < width_);
+  return GetRow(coord.at(1))[coord.at(0)];
+}
+
+template <class C>
+void DynamicImage<C>::ForEach(std::function<void(const C&)> callback) const {
+  for (int32_t y = 0; y < height_; ++y) {
+    const auto* row = GetRow(y);
+    for (int32_t x = 0; x < width_; ++x) {
+      callback(row[x]);
+    }
+  }
+}
+
+template <class C>
+void DynamicImage<C>::SetPixel(const Coord<2>& coord, const C& color) {
+  if (coord.at(0) < 0 || coord.at(0) >= width_ || coord.at(1) < 0 || coord.at(1) >= height_) {
+    return;
+  }
+  GetRow(coord.at(1))[coord.at(0)] = color;
+}
+
+template <class C>
+void DynamicImage<C>::DrawXLine(const Coord<2>& coord, const C& color, int32_t length) {
+  for (int32_t x = coord.at(0); x <= coord.at(0) + length; ++x) {
+    SetPixel({{{{x, coord.at(1)}}}}, color);
+  }
+}
+
+template <class C>
+void DynamicImage<C>::DrawYLine(const Coord<2>& coord, const C& color, int32_t length) {
+  for (int32_t y = coord.at(1); y <= coord.at(1) + length; ++y) {
+    SetPixel({{{{coord.at(0), y}}}}, color);
+  }
+}
+
+template <class C>
+void DynamicImage<C>::DrawRectangle(const Coord<2>& start, const C& color, int32_t x_length, int32_t y_length) {
+  DrawXLine(start, color, x_length);
+  DrawXLine({{{{start.at(0), start.at(1) + y_length}}}}, color, x_length);
+  DrawYLine(start, color, y_length);
+  DrawYLine({{{{start.at(0) + x_length, start.at(1)}}}}, color, y_length);
+}
+
+template <class C>
+void DynamicImage<C>::DrawSquare(const Coord<2>& start, const C& color, int32_t length) {
+  DrawRectangle(start, color, length, length);
+}
+
+template <class C>
+std::string DynamicImage<C>::ToPng(int32_t compression_level) const {
+  return WritePng(*this, compression_level);
+}
+
+template <class C>
+void DynamicImage<C>::Free::operator()(C* ptr) const {
+  free(ptr);
+}
+
+template <class C>
+int32_t DynamicImage<C>::GetStride(int32_t width) {
+  // Smallest pixel count that is a whole number of kAlignment blocks.
+  constexpr auto kPixelsPerBlock = static_cast<int32_t>(kAlignment / Gcd(kAlignment, sizeof(C)));
+  return ((width + kPixelsPerBlock - 1) / kPixelsPerBlock) * kPixelsPerBlock;
+}
+
+template <class C>
+std::unique_ptr<C[], typename DynamicImage<C>::Free> DynamicImage<C>::Allocate(int32_t stride, int32_t height) {
+  static_assert(std::is_trivially_copyable<C>::value);
+  assert(stride >= 0 && height >= 0);
+  void* ptr = nullptr;
+  auto ret = posix_memalign(&ptr, kAlignment, std::max(size_t(1), static_cast<size_t>(stride) * static_cast<size_t>(height) * sizeof(C)));
+  assert(ret == 0);
+  return std::unique_ptr<C[], Free>(static_cast<C*>(ptr));
+}
+
+
+template <int32_t X, int32_t Y, class C>
+std::unique_ptr<Image<X, Y, C>> MakeImageLike(const Image<X, Y, C>&) {
+  return std::make_unique<Image<X, Y, C>>();
+}
+
+template <class C>
+std::unique_ptr<DynamicImage<C>> MakeImageLike(const DynamicImage<C>& image) {
+  return std::make_unique<DynamicImage<C>>(image.GetWidth(), image.GetHeight());
+}
+
+
 static inline void WriteCallback(png_structp png_ptr, png_bytep data, png_size_t length) {
   auto dest = static_cast<std::string*>(png_get_io_ptr(png_ptr));
   dest->append(reinterpret_cast<char*>(data), length);
 }
 
-template <int32_t X, int32_t Y, class C>
-std::string Image<X, Y, C>::ToPng() {
+template <class I>
+std::string WritePng(const I& image, int32_t compression_level) {
   // TODO: specialize this to RgbColor
 
   std::string ret;
@@ -105,17 +334,21 @@ std::string Image<X, Y, C>::ToPng() {
   assert(info_ptr);
 
   png_set_write_fn(png_ptr, &ret, &WriteCallback, nullptr);
-  png_set_IHDR(png_ptr, info_ptr, X, Y,
+  png_set_compression_level(png_ptr, compression_level);
+  png_set_IHDR(png_ptr, info_ptr, static_cast<png_uint_32>(image.GetWidth()), static_cast<png_uint_32>(image.GetHeight()),
     16, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE,
     PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
 
   png_write_info(png_ptr, info_ptr);
-  for (auto& row : *this) {
-    Array<uint16_t, X * 3> out_row;
-    for (int32_t x = 0; x < X; ++x) {
-      out_row.at(x * 3 + 0) = htons(static_cast<uint16_t>(row.at(x).at(0)));
-      out_row.at(x * 3 + 1) = htons(static_cast<uint16_t>(row.at(x).at(1)));
-      out_row.at(x * 3 + 2) = htons(static_cast<uint16_t>(row.at(x).at(2)));
+  // Heap-allocated; a full row can be tens of kilobytes.
+  std::vector<uint16_t> out_row(static_cast<size_t>(image.GetWidth()) * 3);
+  for (int32_t y = 0; y < image.GetHeight(); ++y) {
+    const auto* row = image.GetRow(y);
+    auto* out = out_row.data();
+    for (int32_t x = 0; x < image.GetWidth(); ++x) {
+      out[x * 3 + 0] = htons(static_cast<uint16_t>(row[x].at(0)));
+      out[x * 3 + 1] = htons(static_cast<uint16_t>(row[x].at(1)));
+      out[x * 3 + 2] = htons(static_cast<uint16_t>(row[x].at(2)));
     }
     png_write_row(png_ptr, reinterpret_cast<unsigned char*>(out_row.data()));
   }
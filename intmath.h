@@ -9,3 +9,8 @@ template <typename T>
 constexpr T Interpolate(T val0, T val1, T mul, T div) {
   return val0 + static_cast<int32_t>((static_cast<int64_t>(mul) * (val1 - val0)) / div);
 }
+
+template <typename T>
+constexpr T Gcd(T a, T b) {
+  return b == 0 ? a : Gcd(b, a % b);
+}
@@ -0,0 +1,161 @@
+#include "lab.h"
+
+#include <cmath>
+
+namespace {
+
+constexpr int32_t kTableSize = kNumColors;
+
+// 16-bit sRGB -> linear, and quantized [0, 1] -> CIELAB f(t).
+class LabTables {
+ public:
+  LabTables();
+
+  float GetLinear(int32_t value) const;
+  float GetLabF(float t) const;
+
+ private:
+  Array<float, kTableSize> linear_;
+  Array<float, kTableSize> lab_f_;
+};
+
+LabTables::LabTables() {
+  for (int32_t i = 0; i < kTableSize; ++i) {
+    const double value = static_cast<double>(i) / (kTableSize - 1);
+    linear_.at(i) = static_cast<float>(SrgbToLinear(value));
+    lab_f_.at(i) = static_cast<float>(LabF(value));
+  }
+}
+
+float LabTables::GetLinear(int32_t value) const {
+  return linear_[static_cast<size_t>(std::max(kMinColor, std::min(kMaxColor, value)))];
+}
+
+float LabTables::GetLabF(float t) const {
+  const auto index = static_cast<int32_t>(t * (kTableSize - 1) + 0.5f);
+  return lab_f_[static_cast<size_t>(std::max(0, std::min(kTableSize - 1, index)))];
+}
+
+const LabTables& GetLabTables() {
+  static const LabTables tables;
+  return tables;
+}
+
+}  // namespace
+
+void SrgbToLabRow(const Color<3>* in, int32_t width, LabColor* out) {
+  const auto& tables = GetLabTables();
+
+  // Plain float arithmetic over the row, so the matrix and the Lab
+  // combination vectorize; only the table lookups are gathers.
+  for (int32_t x = 0; x < width; ++x) {
+    const float r = tables.GetLinear(in[x].at(0));
+    const float g = tables.GetLinear(in[x].at(1));
+    const float b = tables.GetLinear(in[x].at(2));
+
+    const float fx = tables.GetLabF((0.4124564f * r + 0.3575761f * g + 0.1804375f * b) * static_cast<float>(1 / kD65WhiteX));
+    const float fy = tables.GetLabF((0.2126729f * r + 0.7151522f * g + 0.0721750f * b) * static_cast<float>(1 / kD65WhiteY));
+    const float fz = tables.GetLabF((0.0193339f * r + 0.1191920f * g + 0.9503041f * b) * static_cast<float>(1 / kD65WhiteZ));
+
+    auto& lab = out[x];
+    lab.at(0) = 116 * fy - 16;
+    lab.at(1) = 500 * (fx - fy);
+    lab.at(2) = 200 * (fy - fz);
+  }
+}
+
+// The formula special-cases exact zeros.
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wfloat-equal"
+
+// Sharma, Wu, Dalal: "The CIEDE2000 Color-Difference Formula: Implementation
+// Notes, Supplementary Test Data, and Mathematical Observations", 2005.
+float Cie2000(const LabColor& lab1, const LabColor& lab2) {
+  constexpr double kPi = 3.14159265358979323846;
+  constexpr double kPow25_7 = 6103515625.0;
+
+  const auto ToRadians = [](double degrees) {
+    return degrees * kPi / 180;
+  };
+  const auto ToDegrees = [](double radians) {
+    return radians * 180 / kPi;
+  };
+
+  const auto l1 = static_cast<double>(lab1.at(0));
+  const auto a1 = static_cast<double>(lab1.at(1));
+  const auto b1 = static_cast<double>(lab1.at(2));
+  const auto l2 = static_cast<double>(lab2.at(0));
+  const auto a2 = static_cast<double>(lab2.at(1));
+  const auto b2 = static_cast<double>(lab2.at(2));
+
+  const double c1 = std::sqrt(a1 * a1 + b1 * b1);
+  const double c2 = std::sqrt(a2 * a2 + b2 * b2);
+  const double c_mean7 = std::pow((c1 + c2) / 2, 7);
+  const double g = 0.5 * (1 - std::sqrt(c_mean7 / (c_mean7 + kPow25_7)));
+
+  const double a1p = (1 + g) * a1;
+  const double a2p = (1 + g) * a2;
+  const double c1p = std::sqrt(a1p * a1p + b1 * b1);
+  const double c2p = std::sqrt(a2p * a2p + b2 * b2);
+
+  const auto Hue = [&ToDegrees](double b, double ap) {
+    if (b == 0 && ap == 0) {
+      return 0.0;
+    }
+    const double h = ToDegrees(std::atan2(b, ap));
+    return h < 0 ? h + 360 : h;
+  };
+  const double h1p = Hue(b1, a1p);
+  const double h2p = Hue(b2, a2p);
+
+  const double delta_lp = l2 - l1;
+  const double delta_cp = c2p - c1p;
+
+  double delta_hp = 0;
+  if (c1p * c2p != 0) {
+    delta_hp = h2p - h1p;
+    if (delta_hp > 180) {
+      delta_hp -= 360;
+    } else if (delta_hp < -180) {
+      delta_hp += 360;
+    }
+  }
+  const double delta_big_hp = 2 * std::sqrt(c1p * c2p) * std::sin(ToRadians(delta_hp / 2));
+
+  const double l_mean = (l1 + l2) / 2;
+  const double c_mean = (c1p + c2p) / 2;
+
+  double h_mean = h1p + h2p;
+  if (c1p * c2p != 0) {
+    if (std::abs(h1p - h2p) <= 180) {
+      h_mean /= 2;
+    } else if (h1p + h2p < 360) {
+      h_mean = (h_mean + 360) / 2;
+    } else {
+      h_mean = (h_mean - 360) / 2;
+    }
+  }
+
+  const double t = 1
+    - 0.17 * std::cos(ToRadians(h_mean - 30))
+    + 0.24 * std::cos(ToRadians(2 * h_mean))
+    + 0.32 * std::cos(ToRadians(3 * h_mean + 6))
+    - 0.20 * std::cos(ToRadians(4 * h_mean - 63));
+
+  const double delta_theta = 30 * std::exp(-std::pow((h_mean - 275) / 25, 2));
+  const double c_mean_7 = std::pow(c_mean, 7);
+  const double r_c = 2 * std::sqrt(c_mean_7 / (c_mean_7 + kPow25_7));
+  const double l_mean_50 = (l_mean - 50) * (l_mean - 50);
+  const double s_l = 1 + (0.015 * l_mean_50) / std::sqrt(20 + l_mean_50);
+  const double s_c = 1 + 0.045 * c_mean;
+  const double s_h = 1 + 0.015 * c_mean * t;
+  const double r_t = -std::sin(ToRadians(2 * delta_theta)) * r_c;
+
+  const double l_term = delta_lp / s_l;
+  const double c_term = delta_cp / s_c;
+  const double h_term = delta_big_hp / s_h;
+
+  return static_cast<float>(std::sqrt(l_term * l_term + c_term * c_term + h_term * h_term + r_t * c_term * h_term));
+}
+
+#pragma clang diagnostic pop
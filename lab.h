@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+
+#include "array.h"
+#include "color.h"
+
+// CIELAB (D65 white point), converted from 16-bit-per-channel sRGB.
+struct LabColor : public Array<float, 3> {};
+
+// Exact conversion, usable at compile time (std::pow isn't constexpr).
+constexpr LabColor SrgbToLab(const Color<3>& srgb);
+
+// Table-driven conversion of a row of pixels, for the scoring loop. Channels
+// are clamped to [kMinColor, kMaxColor] first.
+void SrgbToLabRow(const Color<3>* in, int32_t width, LabColor* out);
+
+// CIEDE2000 color difference.
+float Cie2000(const LabColor& a, const LabColor& b);
+
+
+constexpr double kD65WhiteX = 0.95047;
+constexpr double kD65WhiteY = 1.00000;
+constexpr double kD65WhiteZ = 1.08883;
+
+// x^(1/n) by Newton's method. Starts above the root, so each step decreases
+// until it converges.
+constexpr double ConstexprRoot(double x, int32_t n) {
+  if (x <= 0) {
+    return 0;
+  }
+  double y = x > 1 ? x : 1;
+  for (int32_t i = 0; i < 1000; ++i) {
+    double y_n1 = 1;
+    for (int32_t j = 0; j < n - 1; ++j) {
+      y_n1 *= y;
+    }
+    const double next = y - (y_n1 * y - x) / (n * y_n1);
+    if (!(next < y)) {
+      break;
+    }
+    y = next;
+  }
+  return y;
+}
+
+// sRGB transfer function, [0, 1] -> [0, 1]
+constexpr double SrgbToLinear(double value) {
+  if (value <= 0.04045) {
+    return value / 12.92;
+  }
+  // ((value + 0.055) / 1.055) ^ (12 / 5)
+  const double base = (value + 0.055) / 1.055;
+  double pow12 = 1;
+  for (int32_t i = 0; i < 12; ++i) {
+    pow12 *= base;
+  }
+  return ConstexprRoot(pow12, 5);
+}
+
+// CIELAB f(t)
+constexpr double LabF(double t) {
+  constexpr double kDelta = 6.0 / 29.0;
+  if (t > kDelta * kDelta * kDelta) {
+    return ConstexprRoot(t, 3);
+  }
+  return t / (3 * kDelta * kDelta) + 4.0 / 29.0;
+}
+
+constexpr LabColor SrgbToLab(const Color<3>& srgb) {
+  const double r = SrgbToLinear(static_cast<double>(srgb.at(0)) / kMaxColor);
+  const double g = SrgbToLinear(static_cast<double>(srgb.at(1)) / kMaxColor);
+  const double b = SrgbToLinear(static_cast<double>(srgb.at(2)) / kMaxColor);
+
+  const double fx = LabF((0.4124564 * r + 0.3575761 * g + 0.1804375 * b) / kD65WhiteX);
+  const double fy = LabF((0.2126729 * r + 0.7151522 * g + 0.0721750 * b) / kD65WhiteY);
+  const double fz = LabF((0.0193339 * r + 0.1191920 * g + 0.9503041 * b) / kD65WhiteZ);
+
+  return {{{{
+    static_cast<float>(116 * fy - 16),
+    static_cast<float>(500 * (fx - fy)),
+    static_cast<float>(200 * (fy - fz)),
+  }}}};
+}
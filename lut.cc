@@ -2,3 +2,9 @@
 
 LutBase::~LutBase() {
 }
+
+void LutBase::MapRow(const Color<3>* in, int32_t width, Color<3>* out) const {
+  for (int32_t x = 0; x < width; ++x) {
+    out[x] = MapColor(in[x]);
+  }
+}
@@ -1,9 +1,13 @@
 #pragma once
 
+#include <sstream>
+#include <string>
+
 #include "array.h"
 #include "color.h"
 #include "coord.h"
 #include "image.h"
+#include "telemetry.h"
 
 class LutBase {
  public:
@@ -14,23 +18,26 @@ class LutBase {
   // TODO: Allow other color dimensions
   virtual Color<3> MapColor(const Color<3>& in) const = 0;
 
-  template <int32_t X, int32_t Y, class C>
-  std::unique_ptr<Image<X, Y, C>> MapImage(const Image<X, Y, C>& in) const;
+  // Maps a row of pixels. Override to batch work across the row.
+  virtual void MapRow(const Color<3>* in, int32_t width, Color<3>* out) const;
+
+  // Accepts Image or DynamicImage.
+  template <class I>
+  std::unique_ptr<I> MapImage(const I& in) const;
 
  protected:
   static constexpr std::pair<int32_t, int32_t> FindChannelRoot(int32_t value, int32_t points);
   static constexpr int32_t BlockSize(int32_t points);
 };
 
-template <int32_t X, int32_t Y, class C>
-std::unique_ptr<Image<X, Y, C>> LutBase::MapImage(const Image<X, Y, C>& in) const {
-  auto out = std::make_unique<Image<X, Y, C>>();
+template <class I>
+std::unique_ptr<I> LutBase::MapImage(const I& in) const {
+  ScopedTimer timer("LutBase::MapImage");
 
-  for (int32_t y = 0; y < Y; ++y) {
-    for (int32_t x = 0; x < X; ++x) {
-      Coord<2> coord = {{{{x, y}}}};
-      out->SetPixel(coord, MapColor(in.GetPixel(coord)));
-    }
+  auto out = MakeImageLike(in);
+
+  for (int32_t y = 0; y < in.GetHeight(); ++y) {
+    MapRow(in.GetRow(y), in.GetWidth(), out->GetRow(y));
   }
 
   return out;
@@ -54,6 +61,12 @@ class Lut1d : public Array<Color<3>, X>, public LutBase {
  public:
   static Lut1d<X> Identity();
 
+  // One point per line, channels separated by spaces; written by piphoto
+  // after calibration and loaded for streaming. FromText returns false if
+  // text doesn't hold exactly X points.
+  static bool FromText(const std::string& text, Lut1d<X>* lut);
+  std::string ToText() const;
+
   Color<3> MapColor(const Color<3>& in) const override;
 };
 
@@ -72,6 +85,30 @@ Lut1d<X> Lut1d<X>::Identity() {
   return ret;
 }
 
+template <int32_t X>
+bool Lut1d<X>::FromText(const std::string& text, Lut1d<X>* lut) {
+  std::istringstream is(text);
+  for (auto& color : *lut) {
+    for (auto& channel : color) {
+      if (!(is >> channel)) {
+        return false;
+      }
+    }
+  }
+
+  is >> std::ws;
+  return is.eof();
+}
+
+template <int32_t X>
+std::string Lut1d<X>::ToText() const {
+  std::ostringstream os;
+  for (const auto& color : *this) {
+    os << color.at(0) << " " << color.at(1) << " " << color.at(2) << "\n";
+  }
+  return os.str();
+}
+
 template <int32_t X>
 Color<3> Lut1d<X>::MapColor(const Color<3>& in) const {
   Color<3> ret;
@@ -90,8 +127,60 @@ Color<3> Lut1d<X>::MapColor(const Color<3>& in) const {
 }
 
 
+// Lut1d applied to hue, saturation and value instead of red, green and blue,
+// for hue/saturation adjustments. Hue wraps; saturation and value are cropped.
+template <int32_t X>
+class HsvLut1d : public Lut1d<X> {
+ public:
+  static HsvLut1d<X> Identity();
+
+  Color<3> MapColor(const Color<3>& in) const override;
+  void MapRow(const Color<3>* in, int32_t width, Color<3>* out) const override;
+
+ private:
+  // Pixels converted per batch in MapRow.
+  static constexpr int32_t kChunk = 256;
+};
+
+typedef HsvLut1d<2> MinimalHsvLut1d;
+
+template <int32_t X>
+HsvLut1d<X> HsvLut1d<X>::Identity() {
+  HsvLut1d<X> ret;
+
+  const auto identity = Lut1d<X>::Identity();
+  for (int32_t x = 0; x < X; ++x) {
+    ret.at(x) = identity.at(x);
+  }
+
+  return ret;
+}
+
+template <int32_t X>
+Color<3> HsvLut1d<X>::MapColor(const Color<3>& in) const {
+  // Explicit operators: HsvColor and RgbColor also convert through their
+  // Color<3> constructors, which would skip the conversion.
+  const auto hsv = RgbColor(in).operator HsvColor();
+  return HsvColor(Lut1d<X>::MapColor(hsv)).operator RgbColor();
+}
+
+template <int32_t X>
+void HsvLut1d<X>::MapRow(const Color<3>* in, int32_t width, Color<3>* out) const {
+  Array<Color<3>, kChunk> hsv;
+
+  for (int32_t start = 0; start < width; start += kChunk) {
+    const auto count = std::min(kChunk, width - start);
+    RgbToHsvRow(in + start, count, hsv.data());
+    for (int32_t x = 0; x < count; ++x) {
+      hsv.at(x) = Lut1d<X>::MapColor(hsv.at(x));
+    }
+    HsvToRgbRow(hsv.data(), count, out + start);
+  }
+}
+
+
 template <int32_t X, int32_t Y, int32_t Z>
-class Lut3d : public Array<Array<Array<Color<3>, X>, Y>, Z>, public LutBase {
+class Lut3d : public Array<Array<Array<Color<3>, Z>, Y>, X>, public LutBase {
  public:
   static Lut3d<X, Y, Z> Identity();
 
@@ -1,5 +1,8 @@
 #pragma once
 
+#include "array.h"
+#include "telemetry.h"
+
 template <typename I, typename O>
 struct Range {
   I start;
@@ -8,15 +11,8 @@ struct Range {
   O testpoint_value;
 };
 
-// Find the minimum value of a callback within a range, using a given
-// parallelism.
-//
-// Deterministic for a given parallelism, but not guaranteed to be correct.
-// Since it does a non-exhaustive search, can be fooled by distributions with
-// multiple peaks, especially those with the minimum in a narrow valley and
-// other wider valleys.
 template <typename I, typename O, int32_t P>
-I FindPossibleMinimum(I min, I max, std::function<O(I)> callback) {
+I FindPossibleMinimumStep(I min, I max, const std::function<O(I, I)>& callback, int32_t* evaluations) {
   if (min == max) {
     return min;
   }
@@ -34,8 +30,9 @@ I FindPossibleMinimum(I min, I max, std::function<O(I)> callback) {
 
   // TODO: threads
   for (auto& range : ranges) {
-    range.testpoint_value = callback(range.testpoint);
+    range.testpoint_value = callback(range.testpoint, max - min + 1);
   }
+  *evaluations += P;
 
   const auto& min_range = *std::min_element(ranges.begin(), ranges.end(), [](const Range<I, O>& a, const Range<I, O>& b) {
     return a.testpoint_value < b.testpoint_value;
@@ -44,6 +41,33 @@ I FindPossibleMinimum(I min, I max, std::function<O(I)> callback) {
   if (step == 1) {
     return min_range.testpoint;
   } else {
-    return FindPossibleMinimum<I, O, P>(min_range.start, min_range.end, callback);
+    return FindPossibleMinimumStep<I, O, P>(min_range.start, min_range.end, callback, evaluations);
   }
 }
+
+// As FindPossibleMinimum below, but callback also receives the width of the
+// range being searched. While that is wide, test points are far apart and
+// callback can answer approximately; the final step has width <= P.
+template <typename I, typename O, int32_t P>
+I FindPossibleMinimumCoarseToFine(I min, I max, std::function<O(I value, I width)> callback) {
+  ScopedTimer timer("FindPossibleMinimum");
+
+  int32_t evaluations = 0;
+  auto ret = FindPossibleMinimumStep<I, O, P>(min, max, callback, &evaluations);
+  Telemetry::RecordCounter("FindPossibleMinimum.evaluations", evaluations);
+  return ret;
+}
+
+// Find the minimum value of a callback within a range, using a given
+// parallelism.
+//
+// Deterministic for a given parallelism, but not guaranteed to be correct.
+// Since it does a non-exhaustive search, can be fooled by distributions with
+// multiple peaks, especially those with the minimum in a narrow valley and
+// other wider valleys.
+template <typename I, typename O, int32_t P>
+I FindPossibleMinimum(I min, I max, std::function<O(I)> callback) {
+  return FindPossibleMinimumCoarseToFine<I, O, P>(min, max, [&callback](I value, I) {
+    return callback(value);
+  });
+}
@@ -0,0 +1,219 @@
+#include "parallel.h"
+
+#include <pthread.h>
+#include <signal.h>
+
+#include <algorithm>
+
+namespace {
+
+// The pool whose task the thread is running, if any, and its index there.
+thread_local const ThreadPool* current_pool = nullptr;
+thread_local int32_t thread_index = 0;
+
+// Makes the thread pool's thread 0 while it runs a ParallelFor() from
+// outside, e.g. a worker of another pool.
+class PoolScope {
+ public:
+  explicit PoolScope(const ThreadPool* pool) : pool_(current_pool), index_(thread_index) {
+    if (pool != current_pool) {
+      current_pool = pool;
+      thread_index = 0;
+    }
+  }
+  PoolScope(const PoolScope&) = delete;
+
+  ~PoolScope() {
+    current_pool = pool_;
+    thread_index = index_;
+  }
+
+ private:
+  const ThreadPool* const pool_;
+  const int32_t index_;
+};
+
+constexpr uint64_t Pack(int32_t begin, int32_t end) {
+  return static_cast<uint64_t>(static_cast<uint32_t>(begin)) << 32 | static_cast<uint32_t>(end);
+}
+
+constexpr int32_t GetBegin(uint64_t range) {
+  return static_cast<int32_t>(range >> 32);
+}
+
+constexpr int32_t GetEnd(uint64_t range) {
+  return static_cast<int32_t>(range & 0xffffffff);
+}
+
+}  // namespace
+
+ThreadPool::Job::Job(const std::function<void(int32_t)>& task_in, int32_t count, int32_t num_threads)
+    : task(task_in),
+      ranges(new std::atomic<uint64_t>[static_cast<size_t>(num_threads)]),
+      helpers(0) {
+  for (int32_t i = 0; i < num_threads; ++i) {
+    const auto begin = static_cast<int32_t>(static_cast<int64_t>(count) * i / num_threads);
+    const auto end = static_cast<int32_t>(static_cast<int64_t>(count) * (i + 1) / num_threads);
+    ranges[static_cast<size_t>(i)].store(Pack(begin, end));
+  }
+}
+
+ThreadPool::ThreadPool(int32_t num_threads)
+    : num_threads_(num_threads ? num_threads : std::max(1, static_cast<int32_t>(std::thread::hardware_concurrency()))),
+      stopping_(false) {
+  // Workers start with every signal blocked, so asynchronous ones go to a
+  // thread that expects them, whenever the pool is first created.
+  sigset_t all_signals, previous;
+  sigfillset(&all_signals);
+  pthread_sigmask(SIG_SETMASK, &all_signals, &previous);
+  for (int32_t i = 1; i < num_threads_; ++i) {
+    threads_.emplace_back(&ThreadPool::WorkerLoop, this, i);
+  }
+  pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  changed_.notify_all();
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+}
+
+void ThreadPool::ParallelFor(int32_t count, const std::function<void(int32_t)>& task) {
+  PoolScope scope(this);
+
+  if (num_threads_ == 1 || count <= 1) {
+    for (int32_t i = 0; i < count; ++i) {
+      task(i);
+    }
+    return;
+  }
+
+  Job job(task, count, num_threads_);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    jobs_.push_back(&job);
+  }
+  changed_.notify_all();
+
+  const auto thread = thread_index;
+  Work(&job, thread);
+
+  // Wait out tasks that helpers are still running. Pool threads run other
+  // tasks meanwhile; thread 0 can't, as each caller from outside the pool is
+  // thread 0 of its own job only.
+  std::unique_lock<std::mutex> lock(mutex_);
+  Dequeue(&job);
+  while (job.helpers) {
+    if (thread == 0 || !Help(&lock, thread)) {
+      changed_.wait(lock);
+    }
+  }
+}
+
+int32_t ThreadPool::GetNumThreads() const {
+  return num_threads_;
+}
+
+int32_t ThreadPool::GetThreadIndex() {
+  return thread_index;
+}
+
+ThreadPool* ThreadPool::GetDefault() {
+  // Never destroyed; its threads idle until exit.
+  static auto* pool = new ThreadPool();
+  return pool;
+}
+
+void ThreadPool::WorkerLoop(int32_t thread) {
+  current_pool = this;
+  thread_index = thread;
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!stopping_) {
+    if (!Help(&lock, thread)) {
+      changed_.wait(lock);
+    }
+  }
+}
+
+bool ThreadPool::Help(std::unique_lock<std::mutex>* lock, int32_t thread) {
+  if (jobs_.empty()) {
+    return false;
+  }
+  // The newest job is the most deeply nested, whose caller holds up the
+  // most work while it waits.
+  auto* job = jobs_.back();
+  ++job->helpers;
+  lock->unlock();
+
+  Work(job, thread);
+
+  lock->lock();
+  Dequeue(job);
+  --job->helpers;
+  changed_.notify_all();
+  return true;
+}
+
+void ThreadPool::Work(Job* job, int32_t thread) {
+  do {
+    for (auto i = Claim(job, thread); i >= 0; i = Claim(job, thread)) {
+      job->task(i);
+    }
+  } while (Steal(job, thread));
+}
+
+int32_t ThreadPool::Claim(Job* job, int32_t thread) {
+  auto& range = job->ranges[static_cast<size_t>(thread)];
+  auto current = range.load();
+  while (true) {
+    const auto begin = GetBegin(current);
+    const auto end = GetEnd(current);
+    if (begin >= end) {
+      return -1;
+    }
+    if (range.compare_exchange_weak(current, Pack(begin + 1, end))) {
+      return begin;
+    }
+  }
+}
+
+bool ThreadPool::Steal(Job* job, int32_t thread) {
+  for (int32_t offset = 1; offset < num_threads_; ++offset) {
+    auto& victim = job->ranges[static_cast<size_t>((thread + offset) % num_threads_)];
+    auto current = victim.load();
+    while (true) {
+      const auto begin = GetBegin(current);
+      const auto end = GetEnd(current);
+      if (begin >= end) {
+        break;
+      }
+      // Rounds down, so a single remaining task is stolen whole.
+      const auto middle = begin + (end - begin) / 2;
+      if (victim.compare_exchange_weak(current, Pack(begin, middle))) {
+        // Only thread claims from its own range, and it's empty here, so
+        // concurrent thieves' compare-exchanges against it just fail.
+        job->ranges[static_cast<size_t>(thread)].store(Pack(middle, end));
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+void ThreadPool::Dequeue(Job* job) {
+  const auto iter = std::find(jobs_.begin(), jobs_.end(), job);
+  if (iter != jobs_.end()) {
+    jobs_.erase(iter);
+  }
+}
+
+
+void ParallelFor(int32_t count, const std::function<void(int32_t)>& task) {
+  ThreadPool::GetDefault()->ParallelFor(count, task);
+}
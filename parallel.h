@@ -0,0 +1,87 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Long-lived worker threads for data-parallel loops, so hot paths called
+// once per optimizer round or per streamed frame don't pay thread startup.
+//
+// ParallelFor() splits tasks into one contiguous range per thread. Each
+// thread claims tasks from the front of its own range; once that's empty, it
+// steals the back half of another thread's range, so uneven tasks balance
+// out.
+//
+// Calls from inside a task queue their tasks on the pool too, so nested
+// parallel work (e.g. scoring an ImageSet inside a parallel OptimizeLut)
+// fills threads that the outer loop leaves idle. While waiting for the rest
+// of its tasks, a pool thread helps with others, so nesting doesn't block
+// threads. Calls from unrelated threads run side by side.
+class ThreadPool {
+ public:
+  // num_threads counts the thread calling ParallelFor(); 0 for one per core.
+  explicit ThreadPool(int32_t num_threads = 0);
+  ThreadPool(const ThreadPool&) = delete;
+  ~ThreadPool();
+
+  // Runs task(0) through task(count - 1), on the calling thread and the
+  // pool's. Returns when all tasks are done.
+  void ParallelFor(int32_t count, const std::function<void(int32_t)>& task);
+
+  int32_t GetNumThreads() const;
+
+  // Within a task, which of GetNumThreads() threads runs it, e.g. to index
+  // per-thread scratch buffers. Threads outside the pool are 0. No two
+  // threads running tasks of the same ParallelFor() share an index.
+  static int32_t GetThreadIndex();
+
+  // Process-wide pool with one thread per core, started on first use.
+  static ThreadPool* GetDefault();
+
+ private:
+  // The tasks of one ParallelFor(), owned by its caller's stack.
+  struct Job {
+    Job(const std::function<void(int32_t)>& task, int32_t count, int32_t num_threads);
+
+    const std::function<void(int32_t)>& task;
+    // Unclaimed tasks [begin, end) for each thread, packed as begin << 32 |
+    // end so that the owner (advancing begin) and thieves (lowering end)
+    // can't both take the same task.
+    std::unique_ptr<std::atomic<uint64_t>[]> ranges;
+    // Threads other than the caller inside Work() for this job.
+    int32_t helpers;
+  };
+
+  void WorkerLoop(int32_t thread);
+  // Runs the newest queued job's tasks on thread; false if none is queued.
+  // Called and returns with mutex_ held.
+  bool Help(std::unique_lock<std::mutex>* lock, int32_t thread);
+  // Runs tasks from thread's own range, then stolen ones, until none are
+  // left unclaimed.
+  void Work(Job* job, int32_t thread);
+  // Returns the next task from thread's range, or -1 if it's empty.
+  int32_t Claim(Job* job, int32_t thread);
+  // Moves half of another thread's range into thread's; false if all are
+  // empty.
+  bool Steal(Job* job, int32_t thread);
+  // Stops handing out job, if it's still queued. Needs mutex_.
+  void Dequeue(Job* job);
+
+  const int32_t num_threads_;
+  std::vector<std::thread> threads_;
+
+  std::mutex mutex_;
+  // Signaled when a job is queued or a helper leaves one.
+  std::condition_variable changed_;
+  // Jobs that may have unclaimed tasks, oldest first.
+  std::vector<Job*> jobs_;
+  bool stopping_;
+};
+
+// ThreadPool::GetDefault()->ParallelFor(count, task).
+void ParallelFor(int32_t count, const std::function<void(int32_t)>& task);
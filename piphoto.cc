@@ -1,23 +1,267 @@
+#include <getopt.h>
+
 #include <iostream>
+#include <string>
+#include <vector>
 
 #include "colorchecker.h"
+#include "framecache.h"
 #include "lut.h"
 #include "piraw.h"
+#include "stream.h"
+#include "telemetry.h"
 #include "util.h"
 
-int main() {
-  auto image = PiRaw2::FromJpeg(ReadFile("test.jpg"));
-  WriteFile("start.png", HighlightClosest(*image)->ToPng());
+namespace {
+
+#ifdef PIPHOTO_PIRAW2
+typedef decltype(PiRaw2::FromJpeg(std::string_view()))::element_type Frame;
+#else
+typedef DynamicImage<RgbColor> Frame;
+#endif
+
+struct Input {
+  std::string filename;
+  int32_t weight;
+};
+
+// Parses "filename[:weight]"; weight defaults to 1. A suffix that isn't a
+// positive integer is part of the filename, e.g. "12:30.jpg".
+Input ParseInput(const std::string& arg) {
+  const auto colon = arg.rfind(':');
+  int32_t weight = 0;
+  if (colon == std::string::npos || !ParseInt(arg.substr(colon + 1), &weight) || weight <= 0) {
+    return {arg, 1};
+  }
+  return {arg.substr(0, colon), weight};
+}
+
+// "start.png" for a single input, "start.1.png" etc. for several.
+std::string OutputName(const std::string& base, size_t index, size_t count) {
+  if (count == 1) {
+    return base + ".png";
+  }
+  return base + "." + std::to_string(index) + ".png";
+}
+
+// Decodes the inputs and calibrates one LUT against all of them jointly,
+// scoring with distance policy D. evaluate also scores the result with
+// CIEDE2000, which is too slow to optimize with.
+template <class D>
+int Calibrate(const std::vector<Input>& inputs, Demosaic demosaic, const ScoreSampling& sampling, bool evaluate, bool verbose) {
+#ifdef PIPHOTO_PIRAW2
+  // PiRaw2 decodes with compile-time dimensions, binned 2x2 only.
+  if (demosaic != Demosaic::kBin2x2) {
+    std::cerr << "-d needs a build without PIPHOTO_PIRAW2" << std::endl;
+    return 1;
+  }
+#endif
 
   auto lut = MinimalLut1d::Identity();
-  std::cout << "Initial error: " << ScoreLut(*image, lut) << std::endl;
+
+  FrameCache<Frame> cache;
+  ImageSet<Frame> images;
+  int64_t error = 0;
+
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    const auto& input = inputs.at(i);
+
+    // Exposure stats, patch search and initial score ride along with decode.
+    ColorCheckerAnalysis<D> analysis(lut);
+    auto on_row = [&analysis](int32_t y, const RgbColor* row, int32_t width) {
+      analysis.AddRow(y, row, width);
+    };
+
+    bool decoded;
+    auto image = cache.Get(input.filename, [&]() {
+      const auto jpeg = ReadFile(input.filename);
+#ifdef PIPHOTO_PIRAW2
+      // Compile-time dimensions for v2 camera only deployments.
+      return PiRaw2::FromJpeg(jpeg, on_row);
+#else
+      return DynamicPiRaw::FromJpeg(jpeg, demosaic, on_row);
+#endif
+    }, &decoded);
+    if (!image) {
+      std::cerr << input.filename << ": unrecognized raw sensor mode" << std::endl;
+      return 1;
+    }
+    if (!decoded) {
+      for (int32_t y = 0; y < image->GetHeight(); ++y) {
+        on_row(y, image->GetRow(y), image->GetWidth());
+      }
+    }
+
+    std::cout << input.filename << ": " << analysis.exposure << std::endl;
+    WriteFile(OutputName("start", i, inputs.size()), HighlightClosest(*image, analysis.closest.GetClosest())->ToPng());
+
+    error += static_cast<int64_t>(analysis.score.GetScore()) * input.weight;
+    images.push_back({image, input.weight});
+  }
+  std::cout << "Decoded " << cache.GetNumFrames() << " distinct frame(s)" << std::endl;
+
+  Telemetry::RecordCounter("error", error);
+  std::cout << "Initial error: " << error << std::endl;
 
   int32_t diff = 1;
-  while (diff) {
-    diff = OptimizeLut(*image, &lut);
-    std::cout << "diff=" << diff << " error=" << ScoreLut(*image, lut) << std::endl;
-    WriteFile("inter.png", HighlightClosest(*lut.MapImage(*image))->ToPng());
+  for (int32_t iteration = 0; diff; ++iteration) {
+    diff = OptimizeLut<D>(images, &lut, verbose, sampling);
+    error = ScoreLut<D>(images, lut);
+    Telemetry::RecordCounter("iteration", iteration);
+    Telemetry::RecordCounter("error", error);
+    std::cout << "diff=" << diff << " error=" << error << std::endl;
+    for (size_t i = 0; i < images.size(); ++i) {
+      WriteFile(OutputName("inter", i, images.size()), HighlightClosest<D>(*lut.MapImage(*images.at(i).image))->ToPng());
+    }
   }
 
-  WriteFile("test.png", HighlightClosest(*lut.MapImage(*image))->ToPng());
+  for (size_t i = 0; i < images.size(); ++i) {
+    WriteFile(OutputName("test", i, images.size()), HighlightClosest<D>(*lut.MapImage(*images.at(i).image))->ToPng());
+  }
+  // For -l.
+  WriteFile("lut.txt", lut.ToText());
+
+  if (evaluate) {
+    const auto de2000_error = ScoreLut<Cie2000Distance>(images, lut);
+    Telemetry::RecordCounter("de2000_error", de2000_error);
+    std::cout << "CIEDE2000 error: " << de2000_error << std::endl;
+  }
+
+  return 0;
+}
+
+}  // namespace
+
+// Usage: piphoto [-v] [-d bilinear|malvar] [-m l1|de76] [-e] [-s exact_width] [-t trace.json] [-j events.jsonl] [image.jpg[:weight] ...]
+//        piphoto -i -|spooldir [-l lut.txt] [-o outdir] [-b 2|3] [-d bilinear|malvar] [-t trace.json] [-j events.jsonl]
+//   -v  print every LUT channel update
+//   -d  demosaic at full resolution instead of binning 2x2 (for calibration,
+//       not in PIPHOTO_PIRAW2 builds)
+//   -m  distance metric for scoring (default l1)
+//   -e  also report the final LUT's CIEDE2000 error (slow)
+//   -s  score search probes on pixel samples until the search range is at
+//       most exact_width wide (8 for only the final step); default exact
+//   -t  write a chrome://tracing trace on exit
+//   -j  write telemetry events as JSON lines on exit
+//   -i  stream frames from stdin (raspistill --raw -o -) or *.jpg files moved
+//       into spooldir, until end of input or SIGINT/SIGTERM
+//   -l  LUT to apply when streaming (default identity), as calibration
+//       writes to lut.txt
+//   -o  directory for streamed frame-NNNNNN.png (default .)
+//   -b  frame buffers per stage when streaming (default 3)
+// Images (default test.jpg) are calibrated against jointly; weights default
+// to 1.
+int main(int argc, char* argv[]) {
+  bool verbose = false;
+  bool evaluate = false;
+  Demosaic demosaic = Demosaic::kBin2x2;
+  std::string metric = "l1";
+  ScoreSampling sampling = kExactScoring;
+  std::string trace_file;
+  std::string json_file;
+  std::string stream_input;
+  std::string lut_file;
+  std::string output_dir = ".";
+  int32_t buffers = 3;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "vd:m:es:t:j:i:l:o:b:")) != -1) {
+    switch (opt) {
+      case 'v':
+        verbose = true;
+        break;
+      case 'd':
+        if (std::string(optarg) == "bilinear") {
+          demosaic = Demosaic::kBilinear;
+        } else if (std::string(optarg) == "malvar") {
+          demosaic = Demosaic::kMalvar;
+        } else {
+          std::cerr << "Unknown demosaic mode: " << optarg << std::endl;
+          return 1;
+        }
+        break;
+      case 'm':
+        metric = optarg;
+        break;
+      case 'e':
+        evaluate = true;
+        break;
+      case 's':
+        sampling = kSampledScoring;
+        if (!ParseInt(optarg, &sampling.exact_width) || sampling.exact_width <= 0) {
+          std::cerr << "Invalid exact width: " << optarg << std::endl;
+          return 1;
+        }
+        break;
+      case 't':
+        trace_file = optarg;
+        break;
+      case 'j':
+        json_file = optarg;
+        break;
+      case 'i':
+        stream_input = optarg;
+        break;
+      case 'l':
+        lut_file = optarg;
+        break;
+      case 'o':
+        output_dir = optarg;
+        break;
+      case 'b':
+        if (!ParseInt(optarg, &buffers) || buffers < 2 || buffers > 3) {
+          std::cerr << "Buffers must be 2 or 3: " << optarg << std::endl;
+          return 1;
+        }
+        break;
+      default:
+        std::cerr << "Usage: " << argv[0] << " [-v] [-d bilinear|malvar] [-m l1|de76] [-e] [-s exact_width] [-t trace.json] [-j events.jsonl] [image.jpg[:weight] ...]" << std::endl;
+        std::cerr << "       " << argv[0] << " -i -|spooldir [-l lut.txt] [-o outdir] [-b 2|3] [-d bilinear|malvar] [-t trace.json] [-j events.jsonl]" << std::endl;
+        return 1;
+    }
+  }
+
+  std::vector<Input> inputs;
+  for (int i = optind; i < argc; ++i) {
+    inputs.push_back(ParseInput(argv[i]));
+  }
+  if (inputs.empty()) {
+    inputs.push_back({"test.jpg", 1});
+  }
+
+  if (!trace_file.empty() || !json_file.empty()) {
+    Telemetry::Enable();
+  }
+
+  int ret;
+  if (!stream_input.empty()) {
+    auto lut = MinimalLut1d::Identity();
+    std::string lut_text;
+    if (!lut_file.empty() && (!TryReadFile(lut_file, &lut_text) || !MinimalLut1d::FromText(lut_text, &lut))) {
+      std::cerr << lut_file << ": can't read LUT" << std::endl;
+      return 1;
+    }
+    // Fast PNG compression, to keep up with the camera.
+    ret = RunStream({stream_input, output_dir, demosaic, buffers, 1}, lut);
+  } else if (metric == "l1") {
+    ret = Calibrate<L1Distance>(inputs, demosaic, sampling, evaluate, verbose);
+  } else if (metric == "de76") {
+    ret = Calibrate<Cie76Distance>(inputs, demosaic, sampling, evaluate, verbose);
+  } else if (metric == "de2000") {
+    std::cerr << "de2000 is too slow to calibrate with; use -e to evaluate with it" << std::endl;
+    return 1;
+  } else {
+    std::cerr << "Unknown metric: " << metric << std::endl;
+    return 1;
+  }
+  if (ret) {
+    return ret;
+  }
+
+  if (!trace_file.empty()) {
+    WriteFile(trace_file, Telemetry::ToChromeTrace());
+  }
+  if (!json_file.empty()) {
+    WriteFile(json_file, Telemetry::ToJsonLines());
+  }
 }
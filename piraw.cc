@@ -0,0 +1,96 @@
+#include "piraw.h"
+
+#include "demosaic.h"
+
+namespace {
+
+typedef void (*CombineRawRowsFunc)(const int32_t*, const int32_t*, int32_t, RgbColor*);
+
+CombineRawRowsFunc GetCombineRawRows(BayerOrder bayer) {
+  switch (bayer) {
+    case BayerOrder::kRggb:
+      return &CombineRawRows<BayerOrder::kRggb>;
+    case BayerOrder::kGbrg:
+      return &CombineRawRows<BayerOrder::kGbrg>;
+    case BayerOrder::kBggr:
+      return &CombineRawRows<BayerOrder::kBggr>;
+    case BayerOrder::kGrbg:
+      return &CombineRawRows<BayerOrder::kGrbg>;
+  }
+}
+
+}  // namespace
+
+UnpackRawRowFunc GetUnpackRawRow(int32_t depth) {
+  switch (depth) {
+    case 10:
+      return &UnpackRawRow<10>;
+    case 12:
+      return &UnpackRawRow<12>;
+    default:
+      assert(false);
+      return nullptr;
+  }
+}
+
+const PiRawMode* DynamicPiRaw::FindMode(const std::string_view& jpeg) {
+  for (const auto& mode : kPiRawModes) {
+    size_t container_len = static_cast<size_t>(mode.GetRawBytes() + kPiRawJpegHeaderBytes);
+    if (jpeg.size() >= container_len && jpeg.substr(jpeg.size() - container_len, 4) == kPiRawJpegHeaderMagic) {
+      return &mode;
+    }
+  }
+  return nullptr;
+}
+
+std::unique_ptr<DynamicImage<RgbColor>> DynamicPiRaw::FromJpeg(const std::string_view& jpeg, Demosaic demosaic, const RowCallback& on_row) {
+  const auto* mode = FindMode(jpeg);
+  if (!mode) {
+    return nullptr;
+  }
+  const auto raw_bytes = static_cast<size_t>(mode->GetRawBytes());
+  return FromRaw(*mode, jpeg.substr(jpeg.size() - raw_bytes, raw_bytes), demosaic, on_row);
+}
+
+std::unique_ptr<DynamicImage<RgbColor>> DynamicPiRaw::FromRaw(const PiRawMode& mode, const std::string_view& raw, Demosaic demosaic, const RowCallback& on_row) {
+  auto image = std::make_unique<DynamicImage<RgbColor>>(mode.GetWidth(demosaic), mode.GetHeight(demosaic));
+  DecodeRaw(mode, raw, demosaic, image.get(), on_row);
+  return image;
+}
+
+void DynamicPiRaw::DecodeRaw(const PiRawMode& mode, const std::string_view& raw, Demosaic demosaic, DynamicImage<RgbColor>* out, const RowCallback& on_row, const RowCallback& map_row) {
+  assert(mode.x % 2 == 0);
+  assert(mode.y % 2 == 0);
+  assert(raw.size() == static_cast<size_t>(mode.GetRawBytes()));
+  assert(out->GetWidth() == mode.GetWidth(demosaic) && out->GetHeight() == mode.GetHeight(demosaic));
+
+  if (demosaic != Demosaic::kBin2x2) {
+    DemosaicRaw(mode, raw, demosaic, out, map_row);
+    if (on_row) {
+      for (int32_t y = 0; y < out->GetHeight(); ++y) {
+        on_row(y, out->GetRow(y), out->GetWidth());
+      }
+    }
+    return;
+  }
+
+  ScopedTimer timer("DynamicPiRaw::FromRaw");
+
+  const auto unpack = GetUnpackRawRow(mode.depth);
+  const auto combine = GetCombineRawRows(mode.bayer);
+
+  const auto* data = reinterpret_cast<const uint8_t*>(raw.data());
+  std::vector<int32_t> row0(static_cast<size_t>(mode.x)), row1(static_cast<size_t>(mode.x));
+
+  for (int32_t y = 0; y < mode.y; y += 2) {
+    unpack(data + (y + 0) * mode.row_bytes, mode.x, row0.data());
+    unpack(data + (y + 1) * mode.row_bytes, mode.x, row1.data());
+    combine(row0.data(), row1.data(), mode.x / 2, out->GetRow(y / 2));
+    if (map_row) {
+      map_row(y / 2, out->GetRow(y / 2), mode.x / 2);
+    }
+    if (on_row) {
+      on_row(y / 2, out->GetRow(y / 2), mode.x / 2);
+    }
+  }
+}
@@ -2,123 +2,233 @@
 
 #include <cassert>
 #include <experimental/string_view>
+#include <functional>
+#include <vector>
 
 #include "color.h"
 #include "image.h"
+#include "telemetry.h"
 
 namespace std {
 using string_view = experimental::string_view;
 }
 
-template <int32_t X, int32_t Y, int32_t D, int32_t A, int32_t P>
+// Position of each color within a 2x2 Bayer quad, in row-major order.
+enum class BayerOrder {
+  kRggb,
+  kGbrg,
+  kBggr,
+  kGrbg,
+};
+
+// How Bayer quads become RgbColor pixels.
+enum class Demosaic {
+  // One pixel per 2x2 quad; half resolution.
+  kBin2x2,
+  // Full resolution, averaging nearest same-color neighbors.
+  kBilinear,
+  // Full resolution, Malvar-He-Cutler gradient-corrected linear interpolation.
+  kMalvar,
+};
+
+// Called for each output row as soon as it is decoded, while it is still in
+// cache; lets analysis passes ride along with the decode.
+typedef std::function<void(int32_t y, const RgbColor* row, int32_t width)> RowCallback;
+
+// raspistill --raw appends a fixed-size header, then the raw data, to the JPEG.
+constexpr int32_t kPiRawJpegHeaderBytes = 32768;
+constexpr const char* kPiRawJpegHeaderMagic = "BRCM";
+
+// Unpacks one row of packed D-bit pixels, scaled up to 16 bits. pixels must be
+// a whole number of packed chunks.
+template <int32_t D>
+void UnpackRawRow(const uint8_t* in, int32_t pixels, int32_t* out);
+
+typedef void (*UnpackRawRowFunc)(const uint8_t*, int32_t, int32_t*);
+UnpackRawRowFunc GetUnpackRawRow(int32_t depth);
+
+// Bins each 2x2 Bayer quad of two unpacked rows into one RgbColor.
+template <BayerOrder B>
+void CombineRawRows(const int32_t* row0, const int32_t* row1, int32_t out_pixels, RgbColor* out);
+
+
+// Compile-time sensor mode; loops fold around the fixed dimensions.
+template <int32_t X, int32_t Y, int32_t D, int32_t A, int32_t P, BayerOrder B = BayerOrder::kBggr>
 class PiRaw {
  public:
   PiRaw() = delete;
   PiRaw(const PiRaw&) = delete;
   PiRaw(PiRaw&&) = delete;
 
-  static std::unique_ptr<Image<X / 2, Y / 2, RgbColor>> FromJpeg(const std::string_view& jpeg);
-  static std::unique_ptr<Image<X / 2, Y / 2, RgbColor>> FromRaw(const std::string_view& raw);
+  static std::unique_ptr<Image<X / 2, Y / 2, RgbColor>> FromJpeg(const std::string_view& jpeg, const RowCallback& on_row = nullptr);
+  static std::unique_ptr<Image<X / 2, Y / 2, RgbColor>> FromRaw(const std::string_view& raw, const RowCallback& on_row = nullptr);
+
+  static constexpr int32_t GetRawBytes();
 
  private:
-  static constexpr int32_t kJpegHeaderBytes = 32768;
-  static constexpr const char* kJpegHeaderMagic = "BRCM";
-  static constexpr int32_t kPixelsPerChunk = 4;
   static constexpr int32_t kBitsPerByte = 8;
 
-  static constexpr int32_t GetRawBytes();
   static constexpr int32_t GetRowBytes();
   static constexpr int32_t GetNumRows();
-  static constexpr int32_t GetChunkBytes();
 
   static constexpr int32_t Align(int32_t val);
+};
+
+typedef PiRaw<2592, 1944, 10, 16, 2, BayerOrder::kGbrg> PiRaw1;
+typedef PiRaw<3280, 2464, 10, 16, 2> PiRaw2;
 
-  typedef Array<int32_t, kPixelsPerChunk> Chunk;
 
-  static constexpr Chunk GetChunk(const std::string_view& raw, const int32_t x_chunk, const int32_t y);
-  static constexpr RgbColor CombineRaw(int32_t y0x0, int32_t y0x1, int32_t y1x0, int32_t y1x1);
+// Runtime sensor mode description, for decoding whichever camera produced a
+// file.
+struct PiRawMode {
+  const char* name;
+  int32_t x;
+  int32_t y;
+  int32_t depth;
+  int32_t row_bytes;
+  int32_t num_rows;
+  BayerOrder bayer;
+
+  constexpr int32_t GetRawBytes() const;
+  // Size of the decoded image.
+  constexpr int32_t GetWidth(Demosaic demosaic) const;
+  constexpr int32_t GetHeight(Demosaic demosaic) const;
 };
 
-typedef PiRaw<3280, 2464, 10, 16, 2> PiRaw2;
+// Full-resolution modes written by raspistill --raw.
+constexpr Array<PiRawMode, 3> kPiRawModes = {{{
+  {"ov5647", 2592, 1944, 10, 3264, 1952, BayerOrder::kGbrg},
+  {"imx219", 3280, 2464, 10, 4128, 2480, BayerOrder::kBggr},
+  {"imx477", 4056, 3040, 12, 6112, 3056, BayerOrder::kBggr},
+}}};
+
+class DynamicPiRaw {
+ public:
+  DynamicPiRaw() = delete;
+
+  // Identifies the sensor mode from the size of the raw trailer; nullptr if
+  // no known mode matches.
+  static const PiRawMode* FindMode(const std::string_view& jpeg);
+
+  // nullptr if no known mode matches.
+  static std::unique_ptr<DynamicImage<RgbColor>> FromJpeg(const std::string_view& jpeg, Demosaic demosaic = Demosaic::kBin2x2, const RowCallback& on_row = nullptr);
+  // Output is mode.x / 2 by mode.y / 2 for Demosaic::kBin2x2, otherwise mode.x
+  // by mode.y. Full-resolution modes decode bands out of order across
+  // threads, so on_row runs over the finished image instead.
+  static std::unique_ptr<DynamicImage<RgbColor>> FromRaw(const PiRawMode& mode, const std::string_view& raw, Demosaic demosaic = Demosaic::kBin2x2, const RowCallback& on_row = nullptr);
+
+  // As FromRaw, into an existing image of mode.GetWidth(demosaic) by
+  // mode.GetHeight(demosaic), so buffers can be reused across frames.
+  // map_row, e.g. applying a LUT in place, runs on each row as soon as it's
+  // decoded, before on_row; in full-resolution modes calls may overlap and
+  // come out of order.
+  static void DecodeRaw(const PiRawMode& mode, const std::string_view& raw, Demosaic demosaic, DynamicImage<RgbColor>* out, const RowCallback& on_row = nullptr, const RowCallback& map_row = nullptr);
+};
+
+
+template <>
+inline void UnpackRawRow<10>(const uint8_t* in, int32_t pixels, int32_t* out) {
+  // 4 pixels in 5 bytes: the high 8 bits of each, then all of their low bits.
+  assert(pixels % 4 == 0);
+  for (int32_t x = 0; x < pixels; x += 4, in += 5) {
+    const uint32_t packed_low = in[4];
+    out[x + 0] = static_cast<int32_t>(((uint32_t(in[0]) << 2) | ((packed_low >> 6) & 0b11)) << 6);
+    out[x + 1] = static_cast<int32_t>(((uint32_t(in[1]) << 2) | ((packed_low >> 4) & 0b11)) << 6);
+    out[x + 2] = static_cast<int32_t>(((uint32_t(in[2]) << 2) | ((packed_low >> 2) & 0b11)) << 6);
+    out[x + 3] = static_cast<int32_t>(((uint32_t(in[3]) << 2) | ((packed_low >> 0) & 0b11)) << 6);
+  }
+}
+
+template <>
+inline void UnpackRawRow<12>(const uint8_t* in, int32_t pixels, int32_t* out) {
+  // 2 pixels in 3 bytes: the high 8 bits of each, then both low nibbles.
+  assert(pixels % 2 == 0);
+  for (int32_t x = 0; x < pixels; x += 2, in += 3) {
+    const uint32_t packed_low = in[2];
+    out[x + 0] = static_cast<int32_t>(((uint32_t(in[0]) << 4) | ((packed_low >> 0) & 0b1111)) << 4);
+    out[x + 1] = static_cast<int32_t>(((uint32_t(in[1]) << 4) | ((packed_low >> 4) & 0b1111)) << 4);
+  }
+}
 
-template <int32_t X, int32_t Y, int32_t D, int32_t A, int32_t P>
-typename std::unique_ptr<Image<X / 2, Y / 2, RgbColor>> PiRaw<X, Y, D, A, P>::FromJpeg(const std::string_view& jpeg) {
-  size_t container_len = GetRawBytes() + kJpegHeaderBytes;
-  assert(jpeg.substr(jpeg.size() - container_len, 4) == kJpegHeaderMagic);
-  return FromRaw(jpeg.substr(jpeg.size() - GetRawBytes(), GetRawBytes()));
+template <BayerOrder B>
+void CombineRawRows(const int32_t* row0, const int32_t* row1, int32_t out_pixels, RgbColor* out) {
+  // Index into (y0x0, y0x1, y1x0, y1x1)
+  constexpr int32_t kRed =
+    B == BayerOrder::kRggb ? 0 :
+    B == BayerOrder::kGrbg ? 1 :
+    B == BayerOrder::kGbrg ? 2 : 3;
+  constexpr int32_t kBlue = 3 - kRed;
+
+  for (int32_t x = 0; x < out_pixels; ++x) {
+    const int32_t quad[] = {row0[x * 2 + 0], row0[x * 2 + 1], row1[x * 2 + 0], row1[x * 2 + 1]};
+    auto& pixel = out[x];
+    pixel.at(0) = quad[kRed];
+    pixel.at(1) = (quad[0] + quad[1] + quad[2] + quad[3] - quad[kRed] - quad[kBlue]) / 2;
+    pixel.at(2) = quad[kBlue];
+  }
 }
 
-template <int32_t X, int32_t Y, int32_t D, int32_t A, int32_t P>
-typename std::unique_ptr<Image<X / 2, Y / 2, RgbColor>> PiRaw<X, Y, D, A, P>::FromRaw(const std::string_view& raw) {
+
+template <int32_t X, int32_t Y, int32_t D, int32_t A, int32_t P, BayerOrder B>
+typename std::unique_ptr<Image<X / 2, Y / 2, RgbColor>> PiRaw<X, Y, D, A, P, B>::FromJpeg(const std::string_view& jpeg, const RowCallback& on_row) {
+  size_t container_len = GetRawBytes() + kPiRawJpegHeaderBytes;
+  assert(jpeg.substr(jpeg.size() - container_len, 4) == kPiRawJpegHeaderMagic);
+  return FromRaw(jpeg.substr(jpeg.size() - GetRawBytes(), GetRawBytes()), on_row);
+}
+
+template <int32_t X, int32_t Y, int32_t D, int32_t A, int32_t P, BayerOrder B>
+typename std::unique_ptr<Image<X / 2, Y / 2, RgbColor>> PiRaw<X, Y, D, A, P, B>::FromRaw(const std::string_view& raw, const RowCallback& on_row) {
   static_assert(X % 2 == 0);
   static_assert(Y % 2 == 0);
-  static_assert(kPixelsPerChunk == 4);
 
   assert(raw.size() == GetRawBytes());
 
-  auto image = std::make_unique<Image<X / 2, Y / 2, RgbColor>>();
+  ScopedTimer timer("PiRaw::FromRaw");
 
-  for (int32_t y = 0, out_y = 0; y < Y; y += 2, ++out_y) {
-    for (int32_t x_chunk = 0, out_x = 0; x_chunk < X / kPixelsPerChunk; ++x_chunk, out_x += kPixelsPerChunk / 2) {
-      auto chunk1 = GetChunk(raw, x_chunk, y + 0);
-      auto chunk2 = GetChunk(raw, x_chunk, y + 1);
-      image->at(out_y).at(out_x + 0) = CombineRaw(chunk1.at(0), chunk1.at(1), chunk2.at(0), chunk2.at(1));
-      image->at(out_y).at(out_x + 1) = CombineRaw(chunk1.at(2), chunk1.at(3), chunk2.at(2), chunk2.at(3));
+  auto image = std::make_unique<Image<X / 2, Y / 2, RgbColor>>();
+  const auto* data = reinterpret_cast<const uint8_t*>(raw.data());
+  std::vector<int32_t> row0(X), row1(X);
+
+  for (int32_t y = 0; y < Y; y += 2) {
+    UnpackRawRow<D>(data + (y + 0) * GetRowBytes(), X, row0.data());
+    UnpackRawRow<D>(data + (y + 1) * GetRowBytes(), X, row1.data());
+    CombineRawRows<B>(row0.data(), row1.data(), X / 2, image->GetRow(y / 2));
+    if (on_row) {
+      on_row(y / 2, image->GetRow(y / 2), X / 2);
     }
   }
   return image;
 }
 
-template <int32_t X, int32_t Y, int32_t D, int32_t A, int32_t P>
-constexpr int32_t PiRaw<X, Y, D, A, P>::GetRawBytes() {
+template <int32_t X, int32_t Y, int32_t D, int32_t A, int32_t P, BayerOrder B>
+constexpr int32_t PiRaw<X, Y, D, A, P, B>::GetRawBytes() {
   return GetRowBytes() * GetNumRows();
 }
 
-template <int32_t X, int32_t Y, int32_t D, int32_t A, int32_t P>
-constexpr int32_t PiRaw<X, Y, D, A, P>::GetRowBytes() {
+template <int32_t X, int32_t Y, int32_t D, int32_t A, int32_t P, BayerOrder B>
+constexpr int32_t PiRaw<X, Y, D, A, P, B>::GetRowBytes() {
   return Align(Align(X + P) * D / kBitsPerByte);
 }
 
-template <int32_t X, int32_t Y, int32_t D, int32_t A, int32_t P>
-constexpr int32_t PiRaw<X, Y, D, A, P>::GetNumRows() {
+template <int32_t X, int32_t Y, int32_t D, int32_t A, int32_t P, BayerOrder B>
+constexpr int32_t PiRaw<X, Y, D, A, P, B>::GetNumRows() {
   return Align(Y + P);
 }
 
-template <int32_t X, int32_t Y, int32_t D, int32_t A, int32_t P>
-constexpr int32_t PiRaw<X, Y, D, A, P>::GetChunkBytes() {
-  return D * kPixelsPerChunk / kBitsPerByte;
+template <int32_t X, int32_t Y, int32_t D, int32_t A, int32_t P, BayerOrder B>
+constexpr int32_t PiRaw<X, Y, D, A, P, B>::Align(int32_t val) {
+  return (~(A - 1)) & ((val) + (A - 1));
 }
 
-template <int32_t X, int32_t Y, int32_t D, int32_t A, int32_t P>
-constexpr int32_t PiRaw<X, Y, D, A, P>::Align(int32_t val) {
-  return (~(A - 1)) & ((val) + (A - 1));
+
+constexpr int32_t PiRawMode::GetRawBytes() const {
+  return row_bytes * num_rows;
 }
 
-template <int32_t X, int32_t Y, int32_t D, int32_t A, int32_t P>
-constexpr typename PiRaw<X, Y, D, A, P>::Chunk PiRaw<X, Y, D, A, P>::GetChunk(const std::string_view& raw, const int32_t x_chunk, const int32_t y) {
-  // Function is bit depth & layout specific
-  static_assert(D == 10);
-
-  size_t start = static_cast<size_t>(y * GetRowBytes() + x_chunk * GetChunkBytes());
-  uint32_t high0 = static_cast<uint8_t>(raw.at(start + 0));
-  uint32_t high1 = static_cast<uint8_t>(raw.at(start + 1));
-  uint32_t high2 = static_cast<uint8_t>(raw.at(start + 2));
-  uint32_t high3 = static_cast<uint8_t>(raw.at(start + 3));
-  uint32_t packed_low = static_cast<uint8_t>(raw.at(start + 4));
-
-  Chunk ret;
-  ret.at(0) = static_cast<int32_t>(((high0 << 2) | ((packed_low >> 6) & 0b11)) << 6);
-  ret.at(1) = static_cast<int32_t>(((high1 << 2) | ((packed_low >> 4) & 0b11)) << 6);
-  ret.at(2) = static_cast<int32_t>(((high2 << 2) | ((packed_low >> 2) & 0b11)) << 6);
-  ret.at(3) = static_cast<int32_t>(((high3 << 2) | ((packed_low >> 0) & 0b11)) << 6);
-  return ret;
+constexpr int32_t PiRawMode::GetWidth(Demosaic demosaic) const {
+  return demosaic == Demosaic::kBin2x2 ? x / 2 : x;
 }
 
-template <int32_t X, int32_t Y, int32_t D, int32_t A, int32_t P>
-constexpr RgbColor PiRaw<X, Y, D, A, P>::CombineRaw(int32_t y0x0, int32_t y0x1, int32_t y1x0, int32_t y1x1) {
-  RgbColor ret;
-  ret.at(0) = static_cast<int32_t>(y1x1);
-  ret.at(1) = static_cast<int32_t>((y0x1 + y1x0) / 2);
-  ret.at(2) = static_cast<int32_t>(y0x0);
-  return ret;
+constexpr int32_t PiRawMode::GetHeight(Demosaic demosaic) const {
+  return demosaic == Demosaic::kBin2x2 ? y / 2 : y;
 }
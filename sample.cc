@@ -0,0 +1,13 @@
+#include "sample.h"
+
+const RgbColor* PixelSample::GetPixels() const {
+  return pixels_.data();
+}
+
+int32_t PixelSample::GetSize() const {
+  return static_cast<int32_t>(pixels_.size());
+}
+
+int32_t PixelSample::GetPrefixSize(int32_t pixels) const {
+  return std::min(GetSize(), (pixels + kTiles - 1) / kTiles * kTiles);
+}
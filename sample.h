@@ -0,0 +1,66 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "color.h"
+
+// Fixed, stratified, seeded sample of an image's pixels, for approximate
+// scoring.
+//
+// The image is divided into a grid of tiles. Pixels are stored in rounds of
+// one random pixel per tile, so any whole number of rounds from the start is
+// itself a stratified sample, and a longer prefix is a superset of a shorter
+// one.
+class PixelSample {
+ public:
+  static constexpr int32_t kTilesX = 16;
+  static constexpr int32_t kTilesY = 16;
+  static constexpr int32_t kTiles = kTilesX * kTilesY;
+
+  // Accepts Image or DynamicImage. Stores up to max_pixels, rounded up to a
+  // whole round.
+  template <class I>
+  PixelSample(const I& image, int32_t max_pixels, uint32_t seed);
+
+  const RgbColor* GetPixels() const;
+  // Always a whole number of rounds.
+  int32_t GetSize() const;
+
+  // pixels rounded up to a whole round, and limited to GetSize().
+  int32_t GetPrefixSize(int32_t pixels) const;
+
+ private:
+  std::vector<RgbColor> pixels_;
+};
+
+template <class I>
+PixelSample::PixelSample(const I& image, int32_t max_pixels, uint32_t seed) {
+  assert(image.GetWidth() >= kTilesX && image.GetHeight() >= kTilesY);
+
+  const auto rounds = std::max(1, (max_pixels + kTiles - 1) / kTiles);
+  pixels_.reserve(static_cast<size_t>(rounds * kTiles));
+
+  // mt19937's output sequence is fully specified, unlike the standard
+  // distributions, so samples are the same with any standard library.
+  std::mt19937 rng(seed);
+
+  for (int32_t round = 0; round < rounds; ++round) {
+    for (int32_t tile_y = 0; tile_y < kTilesY; ++tile_y) {
+      const auto y0 = tile_y * image.GetHeight() / kTilesY;
+      const auto y1 = (tile_y + 1) * image.GetHeight() / kTilesY;
+
+      for (int32_t tile_x = 0; tile_x < kTilesX; ++tile_x) {
+        const auto x0 = tile_x * image.GetWidth() / kTilesX;
+        const auto x1 = (tile_x + 1) * image.GetWidth() / kTilesX;
+
+        const auto x = x0 + static_cast<int32_t>(rng() % static_cast<uint32_t>(x1 - x0));
+        const auto y = y0 + static_cast<int32_t>(rng() % static_cast<uint32_t>(y1 - y0));
+        pixels_.push_back(image.GetRow(y)[x]);
+      }
+    }
+  }
+}
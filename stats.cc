@@ -0,0 +1,74 @@
+#include "stats.h"
+
+#include <iomanip>
+
+ExposureStats::ExposureStats()
+    : pixels_(0) {
+  for (auto& histogram : histogram_) {
+    histogram.fill(0);
+  }
+  min_.fill(kMaxColor);
+  max_.fill(kMinColor);
+  sum_.fill(0);
+}
+
+void ExposureStats::AddRow(int32_t, const RgbColor* row, int32_t width) {
+  constexpr int32_t kBinShift = 8;
+
+  for (int32_t c = 0; c < 3; ++c) {
+    auto& histogram = histogram_.at(c);
+    auto min = min_.at(c);
+    auto max = max_.at(c);
+    int64_t sum = 0;
+
+    for (int32_t x = 0; x < width; ++x) {
+      const auto value = row[x].at(c);
+      ++histogram.at(value >> kBinShift);
+      min = std::min(min, value);
+      max = std::max(max, value);
+      sum += value;
+    }
+
+    min_.at(c) = min;
+    max_.at(c) = max;
+    sum_.at(c) += sum;
+  }
+
+  pixels_ += width;
+}
+
+const Array<int64_t, ExposureStats::kHistogramBins>& ExposureStats::GetHistogram(int32_t c) const {
+  return histogram_.at(c);
+}
+
+int32_t ExposureStats::GetMin(int32_t c) const {
+  return min_.at(c);
+}
+
+int32_t ExposureStats::GetMax(int32_t c) const {
+  return max_.at(c);
+}
+
+int32_t ExposureStats::GetMean(int32_t c) const {
+  return pixels_ ? static_cast<int32_t>(sum_.at(c) / pixels_) : 0;
+}
+
+double ExposureStats::GetClipped(int32_t c) const {
+  return pixels_ ? static_cast<double>(histogram_.at(c).at(kHistogramBins - 1)) / static_cast<double>(pixels_) : 0;
+}
+
+std::ostream& operator<<(std::ostream& os, const ExposureStats& stats) {
+  for (int32_t c = 0; c < 3; ++c) {
+    os << "C" << c << ": "
+       << std::hex << std::setfill('0')
+       << "min=0x" << std::setw(4) << stats.GetMin(c)
+       << " mean=0x" << std::setw(4) << stats.GetMean(c)
+       << " max=0x" << std::setw(4) << stats.GetMax(c)
+       << std::dec
+       << " clipped=" << stats.GetClipped(c) * 100 << "%";
+    if (c < 2) {
+      os << "\n";
+    }
+  }
+  return os;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+
+#include "array.h"
+#include "color.h"
+
+// Per-channel exposure diagnostics, accumulated a row at a time.
+class ExposureStats {
+ public:
+  // Histogram bins cover the top 8 bits of each channel.
+  static constexpr int32_t kHistogramBins = 256;
+
+  ExposureStats();
+
+  void AddRow(int32_t y, const RgbColor* row, int32_t width);
+
+  const Array<int64_t, kHistogramBins>& GetHistogram(int32_t c) const;
+  int32_t GetMin(int32_t c) const;
+  int32_t GetMax(int32_t c) const;
+  int32_t GetMean(int32_t c) const;
+  // Fraction of pixels in the top histogram bin of a channel.
+  double GetClipped(int32_t c) const;
+
+ private:
+  Array<Array<int64_t, kHistogramBins>, 3> histogram_;
+  Color<3> min_;
+  Color<3> max_;
+  Array<int64_t, 3> sum_;
+  int64_t pixels_;
+};
+
+std::ostream& operator<<(std::ostream& os, const ExposureStats& stats);
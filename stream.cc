@@ -0,0 +1,462 @@
+#include "stream.h"
+
+#include <dirent.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "parallel.h"
+#include "telemetry.h"
+#include "util.h"
+
+namespace {
+
+// Set by SIGINT/SIGTERM; lock-free, so safe to store from a signal handler.
+std::atomic<bool> stop_requested{false};
+
+void RequestStop(int) {
+  stop_requested.store(true);
+}
+
+
+enum class FrameStatus {
+  kOk,
+  // This frame is lost, but later ones may still arrive.
+  kError,
+  // End of input, or a stop was requested.
+  kEnd,
+};
+
+// Source of frames, each a buffer that DynamicPiRaw::FindMode() accepts.
+class FrameSource {
+ public:
+  virtual ~FrameSource();
+
+  // Reads the next frame into *frame, reusing its allocation.
+  virtual FrameStatus Next(std::string* frame) = 0;
+
+  // Whether input waits for us, so that backpressure can reach it. Otherwise
+  // frames must be read as they arrive, and are dropped if nothing is free.
+  virtual bool CanWait() const = 0;
+};
+
+FrameSource::~FrameSource() {}
+
+
+// raspistill --raw -o - writes frames back to back: a JPEG, then directly
+// after its end-of-image marker, the raw trailer (kPiRawJpegHeaderBytes of
+// header starting with kPiRawJpegHeaderMagic, then the raw data). Only the
+// trailers are kept.
+class PipeFrameSource : public FrameSource {
+ public:
+  explicit PipeFrameSource(int fd);
+
+  FrameStatus Next(std::string* frame) override;
+  bool CanWait() const override;
+
+ private:
+  static constexpr size_t kReadBytes = 1 << 20;
+
+  // Appends more input to buffer_; false at the end of input or on stop.
+  bool Read();
+  // Reads until buffer_ holds at least bytes; false if input ends first.
+  bool Fill(size_t bytes);
+  // buffer_ starts with a trailer. Its mode is the one whose trailer length
+  // is followed by the next JPEG's start-of-image marker, or by the end of
+  // input; this waits for the next frame to start, so is only done once.
+  const PiRawMode* DetectMode();
+
+  const int fd_;
+  std::string buffer_;
+  const PiRawMode* mode_;
+};
+
+PipeFrameSource::PipeFrameSource(int fd)
+    : fd_(fd),
+      mode_(nullptr) {}
+
+FrameStatus PipeFrameSource::Next(std::string* frame) {
+  // JPEG end-of-image marker, then the trailer's magic.
+  constexpr char kTrailerStart[] = "\xff\xd9" "BRCM";
+  constexpr size_t kTrailerStartBytes = sizeof(kTrailerStart) - 1;
+  constexpr size_t kEndOfImageBytes = 2;
+
+  while (true) {
+    size_t start;
+    while ((start = buffer_.find(kTrailerStart, 0, kTrailerStartBytes)) == std::string::npos) {
+      // Keep what could be the beginning of a marker split across reads.
+      if (buffer_.size() >= kTrailerStartBytes) {
+        buffer_.erase(0, buffer_.size() - (kTrailerStartBytes - 1));
+      }
+      if (!Read()) {
+        return FrameStatus::kEnd;
+      }
+    }
+    buffer_.erase(0, start + kEndOfImageBytes);
+
+    if (!mode_) {
+      mode_ = DetectMode();
+      if (!mode_) {
+        if (stop_requested) {
+          return FrameStatus::kEnd;
+        }
+        std::cerr << "stdin: unrecognized raw sensor mode; skipping to the next frame" << std::endl;
+        buffer_.erase(0, kTrailerStartBytes - kEndOfImageBytes);
+        continue;
+      }
+      std::cerr << "stdin: " << mode_->name << " frames" << std::endl;
+    }
+
+    const auto bytes = static_cast<size_t>(kPiRawJpegHeaderBytes + mode_->GetRawBytes());
+    if (!Fill(bytes)) {
+      return FrameStatus::kEnd;
+    }
+    frame->assign(buffer_, 0, bytes);
+    buffer_.erase(0, bytes);
+    return FrameStatus::kOk;
+  }
+}
+
+bool PipeFrameSource::CanWait() const {
+  return false;
+}
+
+bool PipeFrameSource::Read() {
+  const auto size = buffer_.size();
+  buffer_.resize(size + kReadBytes);
+
+  ssize_t bytes;
+  do {
+    bytes = read(fd_, &buffer_[size], kReadBytes);
+  } while (bytes < 0 && errno == EINTR && !stop_requested);
+
+  buffer_.resize(size + static_cast<size_t>(std::max(ssize_t(0), bytes)));
+  return bytes > 0;
+}
+
+bool PipeFrameSource::Fill(size_t bytes) {
+  while (buffer_.size() < bytes) {
+    if (!Read()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+const PiRawMode* PipeFrameSource::DetectMode() {
+  constexpr char kStartOfImage[] = "\xff\xd8";
+  constexpr size_t kStartOfImageBytes = sizeof(kStartOfImage) - 1;
+
+  // kPiRawModes is in increasing size, so input ending early rules out all
+  // remaining modes.
+  for (const auto& mode : kPiRawModes) {
+    const auto bytes = static_cast<size_t>(kPiRawJpegHeaderBytes + mode.GetRawBytes());
+    const auto more = Fill(bytes + kStartOfImageBytes);
+    if (buffer_.size() < bytes) {
+      return nullptr;
+    }
+    if ((!more && buffer_.size() == bytes) || buffer_.compare(bytes, kStartOfImageBytes, kStartOfImage) == 0) {
+      return &mode;
+    }
+  }
+  return nullptr;
+}
+
+
+// Frames are *.jpg files moved into a directory once complete (e.g. written
+// elsewhere on the same filesystem, then renamed in). They are taken in name
+// order and removed once read. Files that can't be read or removed are
+// skipped from then on.
+class SpoolFrameSource : public FrameSource {
+ public:
+  explicit SpoolFrameSource(const std::string& dir);
+
+  FrameStatus Next(std::string* frame) override;
+  bool CanWait() const override;
+
+ private:
+  static constexpr auto kPollInterval = std::chrono::milliseconds(100);
+
+  // First frame name in order, or empty.
+  std::string FindFirst() const;
+
+  const std::string dir_;
+  std::set<std::string> skipped_;
+};
+
+SpoolFrameSource::SpoolFrameSource(const std::string& dir)
+    : dir_(dir) {}
+
+FrameStatus SpoolFrameSource::Next(std::string* frame) {
+  while (!stop_requested) {
+    const auto name = FindFirst();
+    if (name.empty()) {
+      std::this_thread::sleep_for(kPollInterval);
+      continue;
+    }
+
+    const auto path = dir_ + "/" + name;
+    const auto read = TryReadFile(path, frame);
+    // Gone already (e.g. removed between listing and reading) is fine.
+    if (unlink(path.c_str()) != 0 && errno != ENOENT) {
+      std::cerr << path << ": can't remove from spool directory" << std::endl;
+      skipped_.insert(name);
+      return FrameStatus::kError;
+    }
+    if (!read) {
+      std::cerr << path << ": can't read" << std::endl;
+      return FrameStatus::kError;
+    }
+    return FrameStatus::kOk;
+  }
+  return FrameStatus::kEnd;
+}
+
+bool SpoolFrameSource::CanWait() const {
+  return true;
+}
+
+std::string SpoolFrameSource::FindFirst() const {
+  constexpr char kSuffix[] = ".jpg";
+  constexpr size_t kSuffixBytes = sizeof(kSuffix) - 1;
+
+  std::string first;
+
+  auto* dir = opendir(dir_.c_str());
+  if (!dir) {
+    return first;
+  }
+  while (const auto* entry = readdir(dir)) {
+    const std::string name = entry->d_name;
+    if (name.size() > kSuffixBytes && name.at(0) != '.' &&
+        name.compare(name.size() - kSuffixBytes, kSuffixBytes, kSuffix) == 0 &&
+        (first.empty() || name < first) && !skipped_.count(name)) {
+      first = name;
+    }
+  }
+  closedir(dir);
+
+  return first;
+}
+
+
+struct RawFrame {
+  int64_t index;
+  // When input finished reading the frame; latency is measured from here.
+  int64_t start_ns;
+  std::string data;
+};
+
+struct DecodedFrame {
+  int64_t index;
+  int64_t start_ns;
+  std::unique_ptr<DynamicImage<RgbColor>> image;
+};
+
+bool IsDirectory(const std::string& path) {
+  struct stat st;
+  return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+std::string GetOutputName(const std::string& dir, int64_t index) {
+  std::ostringstream os;
+  os << dir << "/frame-" << std::setw(6) << std::setfill('0') << index << ".png";
+  return os.str();
+}
+
+}  // namespace
+
+int RunStream(const StreamOptions& options, const LutBase& lut) {
+  if (options.buffers < 1) {
+    std::cerr << "Need at least one buffer" << std::endl;
+    return 1;
+  }
+
+  std::unique_ptr<FrameSource> source;
+  if (options.input == "-") {
+    source = std::make_unique<PipeFrameSource>(STDIN_FILENO);
+  } else {
+    if (!IsDirectory(options.input)) {
+      std::cerr << options.input << ": not a directory" << std::endl;
+      return 1;
+    }
+    source = std::make_unique<SpoolFrameSource>(options.input);
+  }
+
+  if (!IsDirectory(options.output_dir)) {
+    std::cerr << options.output_dir << ": not a directory" << std::endl;
+    return 1;
+  }
+
+  // Only the input thread takes SIGINT/SIGTERM, so they interrupt its reads.
+  // Every other thread, pool threads included, starts with them blocked.
+  sigset_t stop_signals;
+  sigemptyset(&stop_signals);
+  sigaddset(&stop_signals, SIGINT);
+  sigaddset(&stop_signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &stop_signals, nullptr);
+
+  // Full-resolution demosaic runs its bands on the default pool. Start it
+  // now, rather than in the first frame's latency; it then serves every
+  // frame without starting threads.
+  ThreadPool::GetDefault();
+
+  const auto buffers = static_cast<size_t>(options.buffers);
+
+  // Recycled buffers circulate: free_raw -> input -> raw -> compute ->
+  // free_raw, and free_images -> compute -> decoded -> output -> free_images.
+  BoundedQueue<std::unique_ptr<RawFrame>> free_raw(buffers);
+  BoundedQueue<std::unique_ptr<RawFrame>> raw(buffers);
+  BoundedQueue<std::unique_ptr<DynamicImage<RgbColor>>> free_images(buffers);
+  BoundedQueue<DecodedFrame> decoded(buffers);
+  for (size_t i = 0; i < buffers; ++i) {
+    free_raw.Push(std::make_unique<RawFrame>());
+    // Allocated on first use, once the sensor mode is known.
+    free_images.Push(nullptr);
+  }
+
+  std::atomic<int64_t> dropped{0};
+  int64_t frames = 0;
+  int64_t latency_sum_ns = 0;
+  int64_t latency_max_ns = 0;
+
+  auto Drop = [&dropped](int64_t index, const char* reason) {
+    const auto total = ++dropped;
+    Telemetry::RecordCounter("Stream.dropped", total);
+    std::cerr << "frame " << index << ": dropped (" << reason << ")" << std::endl;
+  };
+
+  auto compute = [&]() {
+    std::unique_ptr<RawFrame> frame;
+    while (raw.Pop(&frame)) {
+      ScopedTimer timer("Stream.compute");
+
+      const auto* mode = DynamicPiRaw::FindMode(frame->data);
+      if (!mode) {
+        Drop(frame->index, "unrecognized raw sensor mode");
+        free_raw.Push(std::move(frame));
+        continue;
+      }
+
+      std::unique_ptr<DynamicImage<RgbColor>> image;
+      if (!free_images.Pop(&image)) {
+        break;
+      }
+      const auto width = mode->GetWidth(options.demosaic);
+      const auto height = mode->GetHeight(options.demosaic);
+      if (!image || image->GetWidth() != width || image->GetHeight() != height) {
+        image = std::make_unique<DynamicImage<RgbColor>>(width, height);
+      }
+
+      auto* out = image.get();
+      const auto raw_bytes = static_cast<size_t>(mode->GetRawBytes());
+      const std::string_view data(frame->data);
+      // In place as each row is decoded, while it's still in cache. Rows are
+      // disjoint, so concurrent full-resolution bands can share lut.
+      DynamicPiRaw::DecodeRaw(*mode, data.substr(data.size() - raw_bytes, raw_bytes), options.demosaic, out, nullptr, [&lut, out](int32_t y, const RgbColor*, int32_t row_width) {
+        lut.MapRow(out->GetRow(y), row_width, out->GetRow(y));
+      });
+
+      decoded.Push({frame->index, frame->start_ns, std::move(image)});
+      free_raw.Push(std::move(frame));
+    }
+    decoded.Close();
+  };
+
+  auto output = [&]() {
+    DecodedFrame frame;
+    while (decoded.Pop(&frame)) {
+      bool written;
+      {
+        ScopedTimer timer("Stream.output");
+        written = TryWriteFile(GetOutputName(options.output_dir, frame.index), frame.image->ToPng(options.png_compression));
+      }
+      if (!written) {
+        Drop(frame.index, "can't write output");
+        free_images.Push(std::move(frame.image));
+        continue;
+      }
+
+      const auto latency_ns = Telemetry::Now() - frame.start_ns;
+      Telemetry::RecordDuration("Stream.frame", frame.start_ns, latency_ns);
+      ++frames;
+      latency_sum_ns += latency_ns;
+      latency_max_ns = std::max(latency_max_ns, latency_ns);
+      std::cerr << "frame " << frame.index << ": " << std::fixed << std::setprecision(1) << static_cast<double>(latency_ns) / 1e6 << " ms" << std::endl;
+
+      free_images.Push(std::move(frame.image));
+    }
+  };
+
+  std::thread compute_thread(compute);
+  std::thread output_thread(output);
+
+  // Without SA_RESTART, so a blocked read returns EINTR.
+  struct sigaction action = {};
+#pragma clang diagnostic push
+  // glibc's sa_handler is a macro for a union member.
+#pragma clang diagnostic ignored "-Wdisabled-macro-expansion"
+  action.sa_handler = &RequestStop;
+#pragma clang diagnostic pop
+  sigaction(SIGINT, &action, nullptr);
+  sigaction(SIGTERM, &action, nullptr);
+  pthread_sigmask(SIG_UNBLOCK, &stop_signals, nullptr);
+
+  // Input runs here.
+  std::string scratch;
+  for (int64_t index = 0; ; ++index) {
+    std::unique_ptr<RawFrame> frame;
+    if (!free_raw.TryPop(&frame)) {
+      if (!source->CanWait()) {
+        const auto status = source->Next(&scratch);
+        if (status == FrameStatus::kEnd) {
+          break;
+        }
+        Drop(index, status == FrameStatus::kOk ? "no free buffer" : "input error");
+        continue;
+      }
+      if (!free_raw.Pop(&frame)) {
+        break;
+      }
+    }
+
+    const auto status = source->Next(&frame->data);
+    if (status == FrameStatus::kEnd) {
+      break;
+    }
+    if (status == FrameStatus::kError) {
+      Drop(index, "input error");
+      free_raw.Push(std::move(frame));
+      continue;
+    }
+    frame->index = index;
+    frame->start_ns = Telemetry::Now();
+    raw.Push(std::move(frame));
+  }
+  raw.Close();
+
+  compute_thread.join();
+  output_thread.join();
+
+  std::cout << "frames=" << frames << " dropped=" << dropped;
+  if (frames) {
+    std::cout << std::fixed << std::setprecision(1)
+              << " latency_mean=" << static_cast<double>(latency_sum_ns) / static_cast<double>(frames) / 1e6 << "ms"
+              << " latency_max=" << static_cast<double>(latency_max_ns) / 1e6 << "ms";
+  }
+  std::cout << std::endl;
+
+  return 0;
+}
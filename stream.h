@@ -0,0 +1,114 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+
+#include "lut.h"
+#include "piraw.h"
+
+// Continuous processing of raspistill --raw frames, e.g. for timelapses:
+// decode, apply a preloaded LUT, write PNGs.
+//
+// Input, compute (decode + LUT) and output (PNG encode + write) run on their
+// own threads, connected by bounded queues. Decoded frames live in a fixed
+// pool of recycled buffers (2 for double, 3 for triple buffering); a slow
+// output stage holds on to them, which stalls compute, which stalls input.
+// A spool directory then simply backs up on disk. A pipe from the camera
+// can't wait, so stdin frames arriving with no free buffer are read and
+// dropped, and counted.
+
+struct StreamOptions {
+  // "-" for stdin, otherwise a spool directory.
+  std::string input;
+  // PNGs are written here as frame-NNNNNN.png.
+  std::string output_dir;
+  Demosaic demosaic;
+  // Frames in flight per stage.
+  int32_t buffers;
+  // See kPngDefaultCompression; favor speed to keep up with the camera.
+  int32_t png_compression;
+};
+
+// Runs until stdin ends, or SIGINT/SIGTERM. Prints per-frame latency to
+// stderr, and a summary including dropped frames at the end. Returns a
+// process exit code.
+int RunStream(const StreamOptions& options, const LutBase& lut);
+
+
+// FIFO between pipeline threads. Push blocks while full, which is how a slow
+// stage applies backpressure to the one before it.
+template <class T>
+class BoundedQueue {
+ public:
+  explicit BoundedQueue(size_t capacity);
+
+  // Blocks while full. Returns false, discarding item, once closed.
+  bool Push(T item);
+  // Blocks while empty. Returns false once closed and drained.
+  bool Pop(T* item);
+  // Returns false if empty.
+  bool TryPop(T* item);
+  // Wakes blocked callers; items already queued can still be popped.
+  void Close();
+
+ private:
+  const size_t capacity_;
+  std::mutex mutex_;
+  std::condition_variable not_empty_;
+  std::condition_variable not_full_;
+  std::deque<T> items_;
+  bool closed_;
+};
+
+template <class T>
+BoundedQueue<T>::BoundedQueue(size_t capacity)
+    : capacity_(capacity),
+      closed_(false) {}
+
+template <class T>
+bool BoundedQueue<T>::Push(T item) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  not_full_.wait(lock, [this]() { return closed_ || items_.size() < capacity_; });
+  if (closed_) {
+    return false;
+  }
+  items_.push_back(std::move(item));
+  not_empty_.notify_one();
+  return true;
+}
+
+template <class T>
+bool BoundedQueue<T>::Pop(T* item) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  not_empty_.wait(lock, [this]() { return closed_ || !items_.empty(); });
+  if (items_.empty()) {
+    return false;
+  }
+  *item = std::move(items_.front());
+  items_.pop_front();
+  not_full_.notify_one();
+  return true;
+}
+
+template <class T>
+bool BoundedQueue<T>::TryPop(T* item) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (items_.empty()) {
+    return false;
+  }
+  *item = std::move(items_.front());
+  items_.pop_front();
+  not_full_.notify_one();
+  return true;
+}
+
+template <class T>
+void BoundedQueue<T>::Close() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  closed_ = true;
+  not_empty_.notify_all();
+  not_full_.notify_all();
+}
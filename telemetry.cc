@@ -0,0 +1,178 @@
+#include "telemetry.h"
+
+#include <chrono>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+namespace {
+
+struct TelemetryEvent {
+  const char* name;
+  bool is_counter;
+  int64_t start_ns;
+  int64_t duration_ns;
+  int64_t value;
+};
+
+// Per thread: ~10 MB of events.
+constexpr size_t kMaxEvents = 1 << 18;
+
+struct TelemetryBuffer {
+  void Append(const TelemetryEvent& event);
+  // Calls f on each kept event, oldest first, then on a Telemetry.dropped
+  // counter if any were overwritten.
+  template <class F>
+  void ForEach(const F& f) const;
+
+  int32_t thread;
+  // A ring once full, with the oldest event at next.
+  std::vector<TelemetryEvent> events;
+  size_t next = 0;
+  int64_t dropped = 0;
+};
+
+void TelemetryBuffer::Append(const TelemetryEvent& event) {
+  if (events.size() < kMaxEvents) {
+    events.push_back(event);
+    return;
+  }
+  events.at(next) = event;
+  next = (next + 1) % kMaxEvents;
+  ++dropped;
+}
+
+template <class F>
+void TelemetryBuffer::ForEach(const F& f) const {
+  for (size_t i = next; i < events.size(); ++i) {
+    f(events.at(i));
+  }
+  for (size_t i = 0; i < next; ++i) {
+    f(events.at(i));
+  }
+  if (dropped) {
+    f(TelemetryEvent{"Telemetry.dropped", true, Telemetry::Now(), 0, dropped});
+  }
+}
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wglobal-constructors"
+#pragma clang diagnostic ignored "-Wexit-time-destructors"
+const auto kStart = std::chrono::steady_clock::now();
+
+// Owns every thread's buffer, so events outlive the threads that recorded them.
+std::mutex buffers_mutex;
+std::vector<std::unique_ptr<TelemetryBuffer>> buffers;
+
+// The calling thread's entry in buffers. On thread exit, gives back the
+// buffer's unused reservation; its events are kept for export.
+class ThreadBuffer {
+ public:
+  ~ThreadBuffer();
+
+  TelemetryBuffer* Get();
+
+ private:
+  TelemetryBuffer* buffer_ = nullptr;
+};
+
+thread_local ThreadBuffer thread_buffer;
+#pragma clang diagnostic pop
+
+ThreadBuffer::~ThreadBuffer() {
+  if (buffer_) {
+    std::lock_guard<std::mutex> lock(buffers_mutex);
+    buffer_->events.shrink_to_fit();
+  }
+}
+
+TelemetryBuffer* ThreadBuffer::Get() {
+  if (!buffer_) {
+    std::lock_guard<std::mutex> lock(buffers_mutex);
+    auto buffer = std::make_unique<TelemetryBuffer>();
+    buffer->thread = static_cast<int32_t>(buffers.size());
+    buffer->events.reserve(1 << 16);
+    buffer_ = buffer.get();
+    buffers.push_back(std::move(buffer));
+  }
+  return buffer_;
+}
+
+}  // namespace
+
+std::atomic<bool> Telemetry::enabled_{false};
+
+void Telemetry::Enable() {
+  enabled_.store(true, std::memory_order_relaxed);
+}
+
+int64_t Telemetry::Now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - kStart).count();
+}
+
+void Telemetry::RecordDuration(const char* name, int64_t start_ns, int64_t duration_ns) {
+  if (!IsEnabled()) {
+    return;
+  }
+  thread_buffer.Get()->Append({name, false, start_ns, duration_ns, 0});
+}
+
+void Telemetry::RecordCounter(const char* name, int64_t value) {
+  if (!IsEnabled()) {
+    return;
+  }
+  thread_buffer.Get()->Append({name, true, Now(), 0, value});
+}
+
+std::string Telemetry::ToJsonLines() {
+  std::lock_guard<std::mutex> lock(buffers_mutex);
+  std::ostringstream os;
+
+  for (const auto& buffer : buffers) {
+    buffer->ForEach([&os, &buffer](const TelemetryEvent& event) {
+      os << "{\"name\": \"" << event.name << "\", "
+         << "\"thread\": " << buffer->thread << ", "
+         << "\"start_ns\": " << event.start_ns << ", ";
+      if (event.is_counter) {
+        os << "\"value\": " << event.value;
+      } else {
+        os << "\"duration_ns\": " << event.duration_ns;
+      }
+      os << "}\n";
+    });
+  }
+
+  return os.str();
+}
+
+std::string Telemetry::ToChromeTrace() {
+  std::lock_guard<std::mutex> lock(buffers_mutex);
+  std::ostringstream os;
+  os << "{\"traceEvents\": [\n";
+
+  bool first = true;
+  for (const auto& buffer : buffers) {
+    buffer->ForEach([&os, &buffer, &first](const TelemetryEvent& event) {
+      if (!first) {
+        os << ",\n";
+      }
+      first = false;
+
+      // Trace Event Format timestamps are in microseconds.
+      os << "  {\"name\": \"" << event.name << "\", "
+         << "\"pid\": 0, "
+         << "\"tid\": " << buffer->thread << ", "
+         << "\"ts\": " << event.start_ns / 1000 << "." << std::setfill('0') << std::setw(3) << event.start_ns % 1000 << ", ";
+      if (event.is_counter) {
+        os << "\"ph\": \"C\", \"args\": {\"value\": " << event.value << "}}";
+      } else {
+        os << "\"ph\": \"X\", \"dur\": " << event.duration_ns / 1000 << "." << std::setfill('0') << std::setw(3) << event.duration_ns % 1000 << "}";
+      }
+    });
+  }
+
+  os << "\n]}\n";
+  return os.str();
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Low-overhead tracing for calibration hot paths.
+//
+// Each thread appends events to its own buffer without locking. Recording is
+// a single relaxed load when disabled. Export (ToJsonLines(), ToChromeTrace())
+// must only be called once recording threads are idle.
+//
+// Each thread keeps only its newest 2^18 events, so long streams don't grow
+// without bound; export reports how many were overwritten as a
+// "Telemetry.dropped" counter on that thread.
+class Telemetry {
+ public:
+  Telemetry() = delete;
+
+  static void Enable();
+  static bool IsEnabled();
+
+  // Nanoseconds since process start.
+  static int64_t Now();
+
+  static void RecordDuration(const char* name, int64_t start_ns, int64_t duration_ns);
+  static void RecordCounter(const char* name, int64_t value);
+
+  // One JSON object per line.
+  static std::string ToJsonLines();
+  // chrome://tracing / Perfetto "Trace Event Format".
+  static std::string ToChromeTrace();
+
+ private:
+  static std::atomic<bool> enabled_;
+};
+
+class ScopedTimer {
+ public:
+  explicit ScopedTimer(const char* name);
+  ScopedTimer(const ScopedTimer&) = delete;
+  ~ScopedTimer();
+
+ private:
+  const char* name_;
+  int64_t start_ns_;
+};
+
+inline bool Telemetry::IsEnabled() {
+  return enabled_.load(std::memory_order_relaxed);
+}
+
+inline ScopedTimer::ScopedTimer(const char* name)
+    : name_(name),
+      start_ns_(Telemetry::IsEnabled() ? Telemetry::Now() : -1) {}
+
+inline ScopedTimer::~ScopedTimer() {
+  if (start_ns_ >= 0) {
+    Telemetry::RecordDuration(name_, start_ns_, Telemetry::Now() - start_ns_);
+  }
+}
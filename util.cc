@@ -6,6 +6,10 @@
 #include <unistd.h>
 
 #include <cassert>
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
 
 std::string ReadFile(const std::string& filename) {
   int fh = open(filename.c_str(), O_RDONLY);
@@ -29,3 +33,84 @@ void WriteFile(const std::string& filename, const std::string& contents) {
   assert(write(fh, &contents[0], contents.size()) == static_cast<ssize_t>(contents.size()));
   assert(close(fh) == 0);
 }
+
+bool TryReadFile(const std::string& filename, std::string* contents) {
+  int fh = open(filename.c_str(), O_RDONLY);
+  if (fh == -1) {
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fh, &st) != 0) {
+    close(fh);
+    return false;
+  }
+
+  contents->resize(static_cast<size_t>(st.st_size));
+
+  size_t done = 0;
+  while (done < contents->size()) {
+    const auto bytes = read(fh, &(*contents)[done], contents->size() - done);
+    if (bytes < 0 && errno == EINTR) {
+      continue;
+    }
+    if (bytes <= 0) {
+      close(fh);
+      return false;
+    }
+    done += static_cast<size_t>(bytes);
+  }
+
+  return close(fh) == 0;
+}
+
+bool TryWriteFile(const std::string& filename, const std::string& contents) {
+  int fh = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fh == -1) {
+    return false;
+  }
+
+  size_t done = 0;
+  while (done < contents.size()) {
+    const auto bytes = write(fh, &contents[done], contents.size() - done);
+    if (bytes < 0 && errno == EINTR) {
+      continue;
+    }
+    if (bytes <= 0) {
+      break;
+    }
+    done += static_cast<size_t>(bytes);
+  }
+
+  if (close(fh) != 0 || done < contents.size()) {
+    unlink(filename.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool ParseInt(const std::string& text, int32_t* value) {
+  // strtoll() would also skip leading whitespace and a '+'.
+  if (text.empty() || !(std::isdigit(static_cast<unsigned char>(text.at(0))) || text.at(0) == '-')) {
+    return false;
+  }
+
+  char* end;
+  errno = 0;
+  const auto parsed = std::strtoll(text.c_str(), &end, 10);
+  if (errno || *end || parsed < INT32_MIN || parsed > INT32_MAX) {
+    return false;
+  }
+
+  *value = static_cast<int32_t>(parsed);
+  return true;
+}
+
+bool GetFileId(const std::string& filename, FileId* id) {
+  struct stat st;
+  if (stat(filename.c_str(), &st) != 0) {
+    return false;
+  }
+  *id = {static_cast<uint64_t>(st.st_dev), static_cast<uint64_t>(st.st_ino)};
+  return true;
+}
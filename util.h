@@ -1,6 +1,24 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
+#include <utility>
 
+// Assert on I/O errors.
 std::string ReadFile(const std::string& filename);
 void WriteFile(const std::string& filename, const std::string& contents);
+
+// Return false on I/O errors instead, for callers that must carry on (e.g.
+// streaming). TryReadFile reuses contents' allocation; TryWriteFile removes a
+// partly written file.
+bool TryReadFile(const std::string& filename, std::string* contents);
+bool TryWriteFile(const std::string& filename, const std::string& contents);
+
+// Parses all of text as a decimal int32_t; false if it isn't one.
+bool ParseInt(const std::string& text, int32_t* value);
+
+// Identifies a file by device and inode, however the path to it is spelled.
+typedef std::pair<uint64_t, uint64_t> FileId;
+
+// False if filename can't be stat()ed.
+bool GetFileId(const std::string& filename, FileId* id);